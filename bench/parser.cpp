@@ -0,0 +1,67 @@
+// Copyright 2023 Sofia Cerasuoli (@SwitchAxe)
+/*
+  This file is part of Rewind.
+  Rewind is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation, either version 3 of the license, or (at your
+  option) any later version.
+  Rewind is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Rewind. If not, see <https://www.gnu.org/licenses/>.
+*/
+// Times the lexer and the parser on generated programs of growing size
+// ('make bench'). The time per token should stay about the same all the
+// way up: the parser is linear in the number of tokens.
+#include "src/evaluator.hpp"
+#include "src/lexer.hpp"
+#include "src/parser.hpp"
+#include "src/vm.hpp"
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+// a bit of everything the parser knows, about 80 tokens
+std::string chunk(int i) {
+  auto n = std::to_string(i);
+  return "let v" + n + " = (+ " + n + " (* 2 " + n + "));\n"
+         "let f" + n + " = (x y) => {\n"
+         "  let s = (s+ \"a\\tb\" (tos x));\n"
+         "  cond | (< x 0) => '[x y " + n + "],\n"
+         "       | true => (g" + n + " y);\n"
+         "};\n"
+         "let g" + n + " = (y) => match y\n"
+         "  | (cons h t) => $h,\n"
+         "  | _ => '{\"k\" y};\n"
+         "print (f" + n + " $v" + n + " '[1 2 3]) \"\\n\";\n";
+}
+
+int main() {
+  Interpreter interpreter;
+  Interpreter::Use use(interpreter);
+  std::printf("%10s %12s %12s %14s\n", "tokens", "lex (ms)", "parse (ms)",
+              "ns per token");
+  for (std::size_t target = 1000; target <= 1000000; target *= 10) {
+    std::string source;
+    std::size_t count = 0;
+    for (int i = 0; count < target; ++i) {
+      auto c = chunk(i);
+      count += get_tokens(c).size();
+      source += c;
+    }
+    using clock = std::chrono::steady_clock;
+    auto t0 = clock::now();
+    auto tokens = get_tokens(source);
+    auto t1 = clock::now();
+    Symbol ast = parse(tokens);
+    auto t2 = clock::now();
+    auto ms = [](auto d) {
+      return std::chrono::duration<double, std::milli>(d).count();
+    };
+    std::printf("%10zu %12.2f %12.2f %14.1f\n", tokens.size(), ms(t1 - t0),
+                ms(t2 - t1), ms(t2 - t0) * 1e6 / tokens.size());
+  }
+}
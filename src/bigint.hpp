@@ -0,0 +1,255 @@
+#pragma once
+// Copyright 2023 Sofia Cerasuoli (@SwitchAxe)
+/*
+  This file is part of Rewind.
+  Rewind is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation, either version 3 of the license, or (at your
+  option) any later version.
+  Rewind is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Rewind. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <algorithm>
+#include <compare>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Arbitrary precision integers, for the numbers that don't fit in an int64
+// (see numeric.hpp). The magnitude is kept in base 2^32 limbs, least
+// significant first and without leading zeros, so zero has no limbs and
+// every value has a single representation.
+class BigInt {
+public:
+  BigInt() = default;
+  BigInt(long long int n) : negative(n < 0) {
+    // negating as unsigned works for the smallest int64 too
+    unsigned long long int m = n;
+    if (negative)
+      m = 0 - m;
+    for (; m != 0; m >>= 32)
+      limbs.push_back(static_cast<std::uint32_t>(m));
+  }
+
+  // decimal digits, with an optional leading '-'
+  static std::optional<BigInt> parse(std::string_view s) {
+    bool neg = !s.empty() && (s[0] == '-');
+    if (neg)
+      s.remove_prefix(1);
+    if (s.empty())
+      return std::nullopt;
+    Limbs l;
+    for (char c : s) {
+      if ((c < '0') || (c > '9'))
+        return std::nullopt;
+      mul_small(l, 10, c - '0');
+    }
+    return make(neg, std::move(l));
+  }
+
+  bool operator==(const BigInt&) const = default;
+  std::strong_ordering operator<=>(const BigInt& other) const {
+    if (negative != other.negative)
+      return negative ? std::strong_ordering::less
+                      : std::strong_ordering::greater;
+    auto c = compare(limbs, other.limbs);
+    return negative ? 0 <=> c : c;
+  }
+
+  BigInt operator-() const { return make(!negative, limbs); }
+  friend BigInt operator+(const BigInt& a, const BigInt& b) {
+    if (a.negative == b.negative)
+      return make(a.negative, add(a.limbs, b.limbs));
+    if (compare(a.limbs, b.limbs) >= 0)
+      return make(a.negative, sub(a.limbs, b.limbs));
+    return make(b.negative, sub(b.limbs, a.limbs));
+  }
+  friend BigInt operator-(const BigInt& a, const BigInt& b) { return a + -b; }
+  friend BigInt operator*(const BigInt& a, const BigInt& b) {
+    return make(a.negative != b.negative, mul(a.limbs, b.limbs));
+  }
+  // these truncate towards zero, like the builtin integers. 'b' must not
+  // be zero.
+  friend BigInt operator/(const BigInt& a, const BigInt& b) {
+    Limbs q, r;
+    divmod(a.limbs, b.limbs, q, r);
+    return make(a.negative != b.negative, std::move(q));
+  }
+  friend BigInt operator%(const BigInt& a, const BigInt& b) {
+    Limbs q, r;
+    divmod(a.limbs, b.limbs, q, r);
+    return make(a.negative, std::move(r));
+  }
+
+  bool is_zero() const { return limbs.empty(); }
+  bool fits_int64() const {
+    if (limbs.size() > 2)
+      return false;
+    unsigned long long int m = magnitude();
+    unsigned long long int max = std::numeric_limits<long long int>::max();
+    return negative ? (m <= max + 1) : (m <= max);
+  }
+  // only if it fits_int64()
+  long long int to_int64() const {
+    unsigned long long int m = magnitude();
+    return negative ? static_cast<long long int>(0 - m)
+                    : static_cast<long long int>(m);
+  }
+
+  double to_double() const {
+    double d = 0;
+    for (std::size_t i = limbs.size(); i-- > 0;)
+      d = d * 4294967296.0 + limbs[i];
+    return negative ? -d : d;
+  }
+
+  std::string to_string() const {
+    if (limbs.empty())
+      return "0";
+    std::string digits;
+    Limbs l = limbs;
+    while (!l.empty()) {
+      std::uint32_t rem = div_small(l, 1000000000);
+      for (int i = 0; i < 9; ++i) {
+        digits.push_back('0' + rem % 10);
+        rem /= 10;
+        if (l.empty() && (rem == 0))
+          break;
+      }
+    }
+    if (negative)
+      digits.push_back('-');
+    std::reverse(digits.begin(), digits.end());
+    return digits;
+  }
+
+private:
+  using Limbs = std::vector<std::uint32_t>;
+
+  bool negative = false;
+  Limbs limbs;
+
+  static BigInt make(bool negative, Limbs l) {
+    while (!l.empty() && (l.back() == 0))
+      l.pop_back();
+    BigInt r;
+    r.negative = negative && !l.empty();
+    r.limbs = std::move(l);
+    return r;
+  }
+
+  unsigned long long int magnitude() const {
+    unsigned long long int m = 0;
+    for (std::size_t i = limbs.size(); i-- > 0;)
+      m = (m << 32) | limbs[i];
+    return m;
+  }
+
+  static std::strong_ordering compare(const Limbs& a, const Limbs& b) {
+    if (a.size() != b.size())
+      return a.size() <=> b.size();
+    for (std::size_t i = a.size(); i-- > 0;)
+      if (a[i] != b[i])
+        return a[i] <=> b[i];
+    return std::strong_ordering::equal;
+  }
+
+  static Limbs add(const Limbs& a, const Limbs& b) {
+    Limbs r(std::max(a.size(), b.size()) + 1);
+    std::uint64_t carry = 0;
+    for (std::size_t i = 0; i < r.size(); ++i) {
+      std::uint64_t s = carry;
+      if (i < a.size())
+        s += a[i];
+      if (i < b.size())
+        s += b[i];
+      r[i] = static_cast<std::uint32_t>(s);
+      carry = s >> 32;
+    }
+    return r;
+  }
+
+  // a >= b
+  static Limbs sub(const Limbs& a, const Limbs& b) {
+    Limbs r(a.size());
+    std::int64_t borrow = 0;
+    for (std::size_t i = 0; i < a.size(); ++i) {
+      std::int64_t d = std::int64_t(a[i]) - borrow;
+      if (i < b.size())
+        d -= b[i];
+      borrow = d < 0;
+      r[i] = static_cast<std::uint32_t>(d + (borrow << 32));
+    }
+    while (!r.empty() && (r.back() == 0))
+      r.pop_back();
+    return r;
+  }
+
+  static Limbs mul(const Limbs& a, const Limbs& b) {
+    Limbs r(a.size() + b.size());
+    for (std::size_t i = 0; i < a.size(); ++i) {
+      std::uint64_t carry = 0;
+      for (std::size_t j = 0; j < b.size(); ++j) {
+        std::uint64_t t = std::uint64_t(a[i]) * b[j] + r[i + j] + carry;
+        r[i + j] = static_cast<std::uint32_t>(t);
+        carry = t >> 32;
+      }
+      r[i + b.size()] = static_cast<std::uint32_t>(carry);
+    }
+    return r;
+  }
+
+  // l = l * m + add
+  static void mul_small(Limbs& l, std::uint32_t m, std::uint32_t add) {
+    std::uint64_t carry = add;
+    for (auto& x : l) {
+      std::uint64_t t = std::uint64_t(x) * m + carry;
+      x = static_cast<std::uint32_t>(t);
+      carry = t >> 32;
+    }
+    if (carry != 0)
+      l.push_back(static_cast<std::uint32_t>(carry));
+  }
+
+  // l /= d, returns the remainder
+  static std::uint32_t div_small(Limbs& l, std::uint32_t d) {
+    std::uint64_t rem = 0;
+    for (std::size_t i = l.size(); i-- > 0;) {
+      std::uint64_t cur = (rem << 32) | l[i];
+      l[i] = static_cast<std::uint32_t>(cur / d);
+      rem = cur % d;
+    }
+    while (!l.empty() && (l.back() == 0))
+      l.pop_back();
+    return static_cast<std::uint32_t>(rem);
+  }
+
+  static void divmod(const Limbs& a, const Limbs& b, Limbs& q, Limbs& r) {
+    if (b.size() == 1) {
+      q = a;
+      std::uint32_t rem = div_small(q, b[0]);
+      r.clear();
+      if (rem != 0)
+        r.push_back(rem);
+      return;
+    }
+    // binary long division, one bit of the quotient at a time
+    q.assign(a.size(), 0);
+    r.clear();
+    for (std::size_t i = a.size() * 32; i-- > 0;) {
+      mul_small(r, 2, (a[i / 32] >> (i % 32)) & 1);
+      if (compare(r, b) >= 0) {
+        r = sub(r, b);
+        q[i / 32] |= std::uint32_t(1) << (i % 32);
+      }
+    }
+  }
+};
@@ -7,57 +7,55 @@ bool convert_value_to_bool(Symbol sym) {
   clause = std::visit(overloaded {
     [](std::string s) { return !s.empty(); },
     [](signed long long int x) { return x != 0; },
-    [](unsigned long long int x) { return x != 0; },
+    [](const BigInt&) { return true; }, // never zero
+    [](double x) { return x != 0; },
     [](bool b) { return b; },
-    [](std::list<Symbol> l) { return !l.empty(); },
+    [](List l) { return !l.empty(); },
+    [](const Map& m) { return !m.empty(); },
     [](std::monostate) { return false; }
   }, sym.value);
   return clause;
 }
 
-std::map<std::string, Functor> boolean = {
-  std::pair{"=", Functor{[](std::list<Symbol> args) -> Symbol {
+constexpr Builtin boolean[] = {
+  Builtin{"=", [](List args) -> Symbol {
+    if (args.empty())
+      throw std::logic_error{"'=': Expected at least one argument!\n"};
     bool is_true = true;
     Symbol prev = args.front();
     args.pop_front();
     for (auto e : args) {
       if ((e.type == prev.type) && (e.type == Type::Number)) {
-	is_true = is_true && std::visit(
-					[]<class T, class U>(T t, U u) -> bool {
-					  return std::cmp_equal(t, u);
-					},
-					get_int(e.value), get_int(prev.value));
+	is_true = is_true && (compare_numbers(e, prev) == 0);
 	continue;
       }
       is_true = is_true && (e.value == prev.value);
       prev = e;
     }
-    return Symbol("", is_true, Type::Boolean);
-  }}},
-  std::pair{"!=", Functor{[](std::list<Symbol> args) -> Symbol {
+    return Symbol(is_true, Type::Boolean);
+  }},
+  Builtin{"!=", [](List args) -> Symbol {
+    if (args.empty())
+      throw std::logic_error{"'!=': Expected at least one argument!\n"};
     bool is_true = true;
     Symbol prev = args.front();
     args.pop_front();
     Symbol lhs;
     for (auto e : args) {
       if ((e.type == prev.type) && (e.type == Type::Number)) {
-        is_true = is_true && std::visit(
-					[]<class T, class U>(T t, U u) -> bool {
-					  return !std::cmp_equal(t, u);
-					},
-					get_int(e.value), get_int(prev.value));
+        is_true = is_true && (compare_numbers(e, prev) != 0);
         continue;
       }
       if (e.type != prev.type) {
-        return Symbol("", true, Type::Boolean);
+        return Symbol(true, Type::Boolean);
       }
       lhs = e;
       is_true = is_true && (lhs.value != prev.value);
       prev = e;
     }
-    return Symbol("", is_true, Type::Boolean);
-  }}},
-  std::pair{"and", Functor{[](std::list<Symbol> args, const path& PATH, variables vs) -> Symbol {
+    return Symbol(is_true, Type::Boolean);
+  }},
+  Builtin{"and", [](List args, const path& PATH, variables& vs) -> Symbol {
     bool is_true = true;
     Symbol clause;
     for (auto e : args) {
@@ -69,12 +67,12 @@ std::map<std::string, Functor> boolean = {
       }
       is_true = is_true && std::get<bool>(e.value);
       if (!is_true) {
-        return Symbol("", false, Type::Boolean);
+        return Symbol(false, Type::Boolean);
       }
     }
-    return Symbol("", is_true, Type::Boolean);
-  }}},
-  std::pair{"or", Functor{[](std::list<Symbol> args, const path& PATH, variables vs) -> Symbol {
+    return Symbol(is_true, Type::Boolean);
+  }},
+  Builtin{"or", [](List args, const path& PATH, variables& vs) -> Symbol {
     bool is_true = false;
     Symbol clause;
     for (auto e : args) {
@@ -86,23 +84,23 @@ std::map<std::string, Functor> boolean = {
       }
       is_true = is_true || std::get<bool>(e.value);
       if (is_true) {
-        return Symbol("", true, Type::Boolean);
+        return Symbol(true, Type::Boolean);
       }
     }
-    return Symbol("", is_true, Type::Boolean);
-  }}},
-  std::pair{"not", Functor{[](std::list<Symbol> args) -> Symbol {
+    return Symbol(is_true, Type::Boolean);
+  }},
+  Builtin{"not", [](List args) -> Symbol {
     if (args.size() > 1) {
       throw std::logic_error{
         "Exception: the 'not' operator only accepts 0 or 1 arguments!\n"};
     }
     if (args.empty()) {
-      return Symbol("", false, Type::Boolean);
+      return Symbol(false, Type::Boolean);
     }
     if (args.front().type != Type::Boolean) {
       throw std::logic_error{
         "Exception: the 'not' operator must accept 0 or 1 booleans!\n"};
     }
-    return Symbol("", !std::get<bool>(args.front().value), Type::Boolean);
-  }}},
+    return Symbol(!std::get<bool>(args.front().value), Type::Boolean);
+  }},
 };
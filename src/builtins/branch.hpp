@@ -1,84 +1,77 @@
 #pragma once
 #include "boolean.hpp"
 #include <compare>
+#include <functional>
 
 
 
-static const Symbol match_any = Symbol("", "_", Type::Identifier);
+static const Symbol match_any = Symbol("_", Type::Identifier);
 static const Symbol match_eq =
-    Symbol("",
-           std::list<Symbol>{Symbol("", "=", Type::Operator),
-                             Symbol("", "x", Type::Identifier)},
+    Symbol(List{Symbol("=", Type::Operator),
+                Symbol("x", Type::Identifier)},
            Type::List);
 
 static const Symbol match_neq =
-    Symbol("",
-           std::list<Symbol>{Symbol("", "!=", Type::Operator),
-                             Symbol("", "x", Type::Identifier)},
+    Symbol(List{Symbol("!=", Type::Operator),
+                Symbol("x", Type::Identifier)},
            Type::List);
 
 static const Symbol match_in_list =
-    Symbol("",
-           std::list<Symbol>{Symbol("", "in", Type::Operator),
-                             Symbol("", "l", Type::Identifier)},
+    Symbol(List{Symbol("in", Type::Operator),
+                Symbol("l", Type::Identifier)},
            Type::List);
 
 static Symbol match_less_than =
-    Symbol("",
-           std::list<Symbol>{Symbol("", "<", Type::Operator),
-                             Symbol("", "x", Type::Number)},
+    Symbol(List{Symbol("<", Type::Operator),
+                Symbol("x", Type::Number)},
            Type::List);
 static const Symbol match_less_than_capture =
-    Symbol("",
-           std::list<Symbol>{Symbol("", "<", Type::Operator),
-                             Symbol("", "a", Type::Number),
-                             Symbol("", "b", Type::Number)},
+    Symbol(List{Symbol("<", Type::Operator),
+                Symbol("a", Type::Number),
+                Symbol("b", Type::Number)},
            Type::List);
 
 static const Symbol match_greater_than =
-    Symbol("",
-           std::list<Symbol>{Symbol("", ">", Type::Operator),
-                             Symbol("", "b", Type::Number)},
+    Symbol(List{Symbol(">", Type::Operator),
+                Symbol("b", Type::Number)},
            Type::List);
 
 static const Symbol match_greater_than_capture =
-    Symbol("",
-           std::list<Symbol>{Symbol("", ">", Type::Operator),
-                             Symbol("", "a", Type::Number),
-                             Symbol("", "b", Type::Number)},
+    Symbol(List{Symbol(">", Type::Operator),
+                Symbol("a", Type::Number),
+                Symbol("b", Type::Number)},
            Type::List);
 
 static const Symbol match_eq_capture =
-    Symbol("",
-           std::list<Symbol>{Symbol("", "=", Type::Operator),
-                             Symbol("", "a", Type::Identifier),
-                             Symbol("", "x", Type::Identifier)},
+    Symbol(List{Symbol("=", Type::Operator),
+                Symbol("a", Type::Identifier),
+                Symbol("x", Type::Identifier)},
            Type::List);
 
 static const Symbol match_neq_capture =
-    Symbol("",
-           std::list<Symbol>{Symbol("", "!=", Type::Operator),
-                             Symbol("", "a", Type::Identifier),
-                             Symbol("", "x", Type::Identifier)},
+    Symbol(List{Symbol("!=", Type::Operator),
+                Symbol("a", Type::Identifier),
+                Symbol("x", Type::Identifier)},
            Type::List);
 
 static const Symbol match_in_list_capture =
-    Symbol("",
-           std::list<Symbol>{Symbol("", "in", Type::Operator),
-                             Symbol("", "a", Type::Identifier),
-                             Symbol("", "l", Type::Identifier)},
+    Symbol(List{Symbol("in", Type::Operator),
+                Symbol("a", Type::Identifier),
+                Symbol("l", Type::Identifier)},
            Type::List);
 
 static const Symbol match_head_tail =
-  Symbol("",
-	 std::list<Symbol>{
-	   Symbol("", "cons", Type::Operator),
-	   Symbol("", "a", Type::Identifier),
-	   Symbol("", "b", Type::Identifier)},
+  Symbol(List{
+	   Symbol("cons", Type::Operator),
+	   Symbol("a", Type::Identifier),
+	   Symbol("b", Type::Identifier)},
 	 Type::List);
 
 
 bool weak_compare(Symbol fst, Symbol other) {
+  if (((fst.type == Type::Operator) || (other.type == Type::Operator)) &&
+      (fst.id != no_symbol) && (other.id != no_symbol))
+    return fst.id == other.id;
   if (fst.type == Type::Operator)
     return std::get<std::string>(fst.value) ==
 	   std::get<std::string>(other.value);
@@ -92,8 +85,8 @@ bool weak_compare(Symbol fst, Symbol other) {
   if (fst.type == other.type) {
     if ((fst.type == Type::List) || (fst.type == Type::ListLiteral)) {
       bool is_same_pattern = true;
-      auto ll = std::get<std::list<Symbol>>(fst.value);
-      auto otherl = std::get<std::list<Symbol>>(other.value);
+      const auto& ll = std::get<List>(fst.value);
+      const auto& otherl = std::get<List>(other.value);
       if (ll.size() != otherl.size())
         return false;
       std::list<std::pair<Symbol, Symbol>> zipped;
@@ -119,8 +112,8 @@ bool compare_list_structure(Symbol l, Symbol r) {
   if ((r.type != Type::List) && (r.type != Type::ListLiteral))
     throw std::logic_error{"Second operand to 'compare_list_structure' "
                            "(internal function) is not a list!\n"};
-  auto ll = std::get<std::list<Symbol>>(l.value);
-  auto rl = std::get<std::list<Symbol>>(r.value);
+  const auto& ll = std::get<List>(l.value);
+  const auto& rl = std::get<List>(r.value);
   if (ll.size() != rl.size())
     return false;
   if (ll.empty())
@@ -157,8 +150,8 @@ bool compare_list_structure(Symbol l, Symbol r) {
 
 std::list<std::pair<Symbol, Symbol>> rec_bind_list(Symbol lhs, Symbol rhs) {
   std::list<std::pair<Symbol, Symbol>> ret;
-  auto fst = std::get<std::list<Symbol>>(lhs.value);
-  auto snd = std::get<std::list<Symbol>>(rhs.value);
+  const auto& fst = std::get<List>(lhs.value);
+  const auto& snd = std::get<List>(rhs.value);
   std::list<std::pair<Symbol, Symbol>> zipped;
   std::transform(fst.begin(), fst.end(), snd.begin(),
                  std::back_inserter(zipped),
@@ -179,6 +172,49 @@ std::list<std::pair<Symbol, Symbol>> rec_bind_list(Symbol lhs, Symbol rhs) {
 // some auxillary functions to not repeat code in the
 // following map.
 
+// true if 'x' is an element of the list, or a key of the map, 'coll'
+bool match_in(const Symbol& x, const Symbol& coll) {
+  if (auto m = std::get_if<Map>(&coll.value))
+    return m->find(x) != nullptr;
+  if ((coll.type != Type::List) && (coll.type != Type::ListLiteral))
+    throw std::logic_error {"'in' (match): expected a list or a map!\n"};
+  const auto& l = std::get<List>(coll.value);
+  return std::find_if(l.begin(), l.end(), [&](const Symbol& y) -> bool {
+    return x.value == y.value;
+  }) != l.end();
+}
+
+// a '{k1 p1 k2 p2 ...} pattern accepts the maps holding every key k, with a
+// value matching its p: a name captures the value, "_" accepts anything, a
+// map pattern destructures it in turn, and anything else is evaluated and
+// compared to it. The captures are added to 'binds'.
+bool match_map(const Symbol& pat, const Symbol& matched, List& binds,
+               variables& vs, const path& PATH) {
+  auto m = std::get_if<Map>(&matched.value);
+  if (m == nullptr)
+    return false;
+  const auto& l = std::get<List>(pat.value);
+  for (std::size_t i = 0; i + 1 < l.size(); i += 2) {
+    const Symbol* v = m->find(eval(l[i], PATH, vs));
+    if (v == nullptr)
+      return false;
+    const Symbol& p = l[i + 1];
+    if (p.type == Type::MapLiteral) {
+      if (!match_map(p, *v, binds, vs, PATH))
+        return false;
+    } else if ((p.type == Type::Identifier) &&
+               std::holds_alternative<std::string>(p.value) &&
+               !std::get<std::string>(p.value).starts_with('$')) {
+      if (std::get<std::string>(p.value) != "_") {
+        binds.push_back(p);
+        binds.push_back(*v);
+      }
+    } else if (!same_value(eval(p, PATH, vs), *v))
+      return false;
+  }
+  return true;
+}
+
 std::optional<bool> do_ordering_match(Symbol s1, Symbol s2,
                                       std::strong_ordering ord) {
   if (ord == std::strong_ordering::equal)
@@ -188,61 +224,30 @@ std::optional<bool> do_ordering_match(Symbol s1, Symbol s2,
   if (s1.type != Type::Number)
     return std::nullopt;
   
-  // truncate both numbers to signed ints
-  long long int a = std::visit(overloaded {
-    [](long long int n) -> long long int { return n; },
-    [](long long unsigned int n) -> long long int { return n; },
-    [](auto) -> long long int { return 0; }
-  }, s1.value);
-
-  long long int b = std::visit(overloaded {
-    [](long long int n) -> long long int { return n; },
-    [](long long unsigned int n) -> long long int { return n; },
-    [](auto) -> long long int { return 0; }
-  }, s2.value);
-
+  auto c = compare_numbers(s1, s2);
   if (ord == std::strong_ordering::less)
-    return std::optional<bool>{a < b};
-  else return std::optional<bool>{a > b};
+    return std::optional<bool>{c < 0};
+  else return std::optional<bool>{c > 0};
 }
 
-std::list<std::pair<Symbol, std::function<std::optional<Symbol>(Symbol, std::list<Symbol>, variables,
-				      const path&, std::list<Symbol>)>>>
+// each pattern checks the matched value and, if it accepts it, binds its
+// captures in 'vs'. The body of the arm is evaluated by the caller.
+std::list<std::pair<Symbol, std::function<bool(Symbol, List, variables&,
+					      const path&)>>>
 patterns = {
-  std::pair{match_in_list, [](Symbol matched, std::list<Symbol> l, variables vs,
-			      const path& PATH,
-			      std::list<Symbol> body) -> std::optional<Symbol> {
-    auto s = l.back();
-    if ((s.type != Type::List) && (s.type != Type::ListLiteral))
-      throw std::logic_error {"'in' (match): expected a list!\n"};
-    auto x = std::get<std::list<Symbol>>(s.value);
-    if (std::find_if(x.begin(), x.end(),
-                     [&](Symbol y) -> bool {
-                       return matched.value == y.value;
-                     }) != x.end()) {
-      Symbol result;
-      for (auto e : body)
-	result = eval(e, PATH, vs);
-      return result;
-    }
-    return std::nullopt;
+  std::pair{match_in_list, [](Symbol matched, List l, variables& vs,
+			      const path& PATH) -> bool {
+    return match_in(matched, eval(l.back(), PATH, vs));
   }},
-  std::pair{match_less_than, [](Symbol matched, std::list<Symbol> l, variables vs,
-				const path& PATH,
-				std::list<Symbol> body) -> std::optional<Symbol> {
+  std::pair{match_less_than, [](Symbol matched, List l, variables& vs,
+				const path& PATH) -> bool {
     Symbol s = l.back();
     auto opt = do_ordering_match(matched, eval(s, PATH, vs),
 				 std::strong_ordering::less);
-    if ((opt != std::nullopt) && *opt) {  Symbol result;
-      for (auto e: body)
-	result = eval(e, PATH, vs);
-      return result;
-    }
-    return std::nullopt;
+    return (opt != std::nullopt) && *opt;
   }},
-  std::pair{match_less_than_capture, [](Symbol matched, std::list<Symbol> l, variables vs,
-					const path& PATH,
-					std::list<Symbol> body) -> std::optional<Symbol> {
+  std::pair{match_less_than_capture, [](Symbol matched, List l, variables& vs,
+					const path& PATH) -> bool {
     l.pop_front();
     Symbol var = l.front();
     l.pop_front();
@@ -250,32 +255,21 @@ patterns = {
     auto opt = do_ordering_match(matched, eval(s, PATH, vs),
 				 std::strong_ordering::less);
     if ((opt != std::nullopt) && *opt) {
-      Symbol result;
       vs.insert({std::get<std::string>(var.value), matched});
-      for (auto e : body)
-	result = eval(e, PATH, vs);
-      return result;
+      return true;
     }
-    return std::nullopt;
+    return false;
   }},
-  std::pair{match_greater_than, [](Symbol matched, std::list<Symbol> l, variables vs,
-				   const path& PATH,
-				   std::list<Symbol> body) -> std::optional<Symbol> {
+  std::pair{match_greater_than, [](Symbol matched, List l, variables& vs,
+				   const path& PATH) -> bool {
     Symbol s = l.back();
     auto opt = do_ordering_match(matched, eval(s, PATH, vs),
 				 std::strong_ordering::greater);
-    if ((opt != std::nullopt) && *opt) {
-      Symbol result;
-      for (auto e: body)
-	result = eval(e, PATH, vs);
-      return result;
-    }
-    return std::nullopt;
+    return (opt != std::nullopt) && *opt;
   }},
-  std::pair{match_greater_than_capture, [](Symbol matched, std::list<Symbol> l,
-					   variables vs,
-					   const path& PATH,
-					   std::list<Symbol> body) -> std::optional<Symbol> {
+  std::pair{match_greater_than_capture, [](Symbol matched, List l,
+					   variables& vs,
+					   const path& PATH) -> bool {
     l.pop_front();
     Symbol var = l.front();
     l.pop_front();
@@ -283,31 +277,20 @@ patterns = {
     auto opt = do_ordering_match(matched, eval(s, PATH, vs),
 				 std::strong_ordering::greater);
     if ((opt != std::nullopt) && *opt) {
-      Symbol result;
       vs.insert({std::get<std::string>(var.value), matched});
-      for (auto e : body)
-	result = eval(e, PATH, vs);
-      return result;
+      return true;
     }
-    return std::nullopt;
+    return false;
   }},
-  std::pair{match_eq, [](Symbol matched, std::list<Symbol> l, variables vs,
-			 const path& PATH,
-			 std::list<Symbol> body) -> std::optional<Symbol> {
+  std::pair{match_eq, [](Symbol matched, List l, variables& vs,
+			 const path& PATH) -> bool {
     Symbol s = l.back();
     auto opt = do_ordering_match(matched, eval(s, PATH, vs),
 				 std::strong_ordering::equal);
-    if ((opt != std::nullopt) && *opt) {
-      Symbol result;
-      for (auto e: body)
-	result = eval(e, PATH, vs);
-      return result;
-    }
-    return std::nullopt;
+    return (opt != std::nullopt) && *opt;
   }},
-  std::pair{match_eq_capture, [](Symbol matched, std::list<Symbol> l, variables vs,
-				 const path& PATH,
-				 std::list<Symbol> body) -> std::optional<Symbol> {
+  std::pair{match_eq_capture, [](Symbol matched, List l, variables& vs,
+				 const path& PATH) -> bool {
     l.pop_front();
     Symbol var = l.front();
     l.pop_front();
@@ -315,31 +298,20 @@ patterns = {
     auto opt = do_ordering_match(matched, eval(s, PATH, vs),
 				 std::strong_ordering::equal);
     if ((opt != std::nullopt) && *opt) {
-      Symbol result;
       vs.insert({std::get<std::string>(var.value), matched});
-      for (auto e : body)
-	result = eval(e, PATH, vs);
-      return result;
+      return true;
     }
-    return std::nullopt;
+    return false;
   }},
-  std::pair{match_neq, [](Symbol matched, std::list<Symbol> l, variables vs,
-			  const path& PATH,
-			  std::list<Symbol> body) -> std::optional<Symbol> {
+  std::pair{match_neq, [](Symbol matched, List l, variables& vs,
+			  const path& PATH) -> bool {
     Symbol s = l.back();
     auto opt = do_ordering_match(matched, eval(s, PATH, vs),
 				 std::strong_ordering::equal);
-    if ((opt != std::nullopt) && !*opt) {
-      Symbol result;
-      for (auto e: body)
-	result = eval(e, PATH, vs);
-      return result;
-    }
-    return std::nullopt;
+    return (opt != std::nullopt) && !*opt;
   }},
-  std::pair{match_neq_capture, [](Symbol matched, std::list<Symbol> l, variables vs,
-				  const path& PATH,
-				  std::list<Symbol> body) -> std::optional<Symbol> {
+  std::pair{match_neq_capture, [](Symbol matched, List l, variables& vs,
+				  const path& PATH) -> bool {
     l.pop_front();
     Symbol var = l.front();
     l.pop_front();
@@ -347,66 +319,103 @@ patterns = {
     auto opt = do_ordering_match(matched, eval(s, PATH, vs),
 				 std::strong_ordering::equal);
     if ((opt != std::nullopt) && !*opt) {
-      Symbol result;
       vs.insert({std::get<std::string>(var.value), matched});
-      for (auto e : body)
-	result = eval(e, PATH, vs);
-      return result;
+      return true;
     }
-    return std::nullopt;
+    return false;
   }},
-  std::pair{match_head_tail, [](Symbol matched, std::list<Symbol> l, variables vs,
-				const path& PATH,
-				std::list<Symbol> body) -> std::optional<Symbol> {
+  std::pair{match_head_tail, [](Symbol matched, List l, variables& vs,
+				const path& PATH) -> bool {
     if ((matched.type != Type::List) && (matched.type != Type::ListLiteral))
       throw std::logic_error {"in 'cons' (match): expected a list to destructure!\n"};
-    auto x = std::get<std::list<Symbol>>(matched.value);
+    const auto& whole = std::get<List>(matched.value);
     l.pop_front();
     std::string head = std::get<std::string>(l.front().value);
     std::string tail = std::get<std::string>(l.back().value);
-    vs.insert(std::pair{head, x.front()});
+    vs.insert(std::pair{head, whole.front()});
+    List x = whole; // shares the elements with the matched list
     x.pop_front();
-    vs.insert(std::pair{tail, Symbol("", x, matched.type)});
-    Symbol result;
-    for (auto e : body)
-      result = eval(e, PATH, vs);
-    return result;
+    vs.insert(std::pair{tail, Symbol(x, matched.type)});
+    return true;
   }},
-  std::pair{match_in_list_capture, [](Symbol matched, std::list<Symbol> l, variables vs,
-				      const path& PATH,
-				      std::list<Symbol> body) -> std::optional<Symbol> {
+  std::pair{match_in_list_capture, [](Symbol matched, List l, variables& vs,
+				      const path& PATH) -> bool {
     l.pop_front();
     std::string id = std::get<std::string>(l.front().value);
-    auto x = l.back();
-    x = eval(x, PATH, vs);
-    auto y = std::get<std::list<Symbol>>(x.value);
-    Symbol result;
-    if (auto it = std::find_if(y.begin(),
-				y.end(),
-				[&](Symbol a) -> bool {
-				  return a.value == matched.value; }); it != y.end()) {
+    if (match_in(matched, eval(l.back(), PATH, vs))) {
       vs.insert(std::pair{id, matched});
-      for (auto e : body)
-	result = eval(e, PATH, vs);
-      return result;
+      return true;
     }
-    return std::nullopt;
+    return false;
   }}
 };
 
-std::map<std::string, Functor> branching = {
-  std::pair{"cond",
-            Functor{[](std::list<Symbol> args,
-                       const path& PATH,
-                       variables& vs) {
-              Symbol result = Symbol("", false, Type::Boolean);
+// finds the first arm of a 'match' accepting 'matched', binds its captures
+// in 'scope' and returns its body.
+std::optional<List> select_match_arm(const Symbol& matched, const List& arms,
+				     variables& scope, const path& PATH) {
+  for (auto& e : arms) {
+    auto l = std::get<List>(e.value);
+    auto pat = l.front();
+    l.pop_front();
+
+    // a special rule for the 'any' ("_") fallback pattern.
+    if (pat.type == Type::Identifier)
+      if (std::get<std::string>(pat.value) == "_") {
+	scope.insert({"_", matched});
+	return l;
+      }
+
+    if (pat.type == Type::MapLiteral) {
+      List binds;
+      if (!match_map(pat, matched, binds, scope, PATH))
+        continue;
+      for (std::size_t i = 0; i < binds.size(); i += 2)
+        scope.insert({binds[i].id, binds[i + 1]});
+      return l;
+    }
+
+    if ((pat.type != Type::List)) {
+      if (pat.value == matched.value)
+	return l;
+    }
+    if (!std::holds_alternative<List>(pat.value))
+      continue;
+    const auto& x = std::get<List>(pat.value);
+    if ((matched.type == Type::List) || (matched.type == Type::ListLiteral)) {
+      if ((pat.type == Type::ListLiteral) &&
+	  compare_list_structure(pat, matched)) {
+	auto ps = rec_bind_list(pat, matched);
+	for (auto [var, val] : ps) {
+	  scope.insert({std::get<std::string>(var.value), val});
+	}
+	return l;
+      }
+    }
+    for (auto& [k, v] : patterns) {
+      if (weak_compare(pat, k)) {
+	if (v(matched, x, scope, PATH))
+	  return l;
+	break;
+      }
+    }
+  }
+  return std::nullopt;
+}
+
+constexpr Builtin branching[] = {
+  Builtin{"cond",
+          [](List args,
+             const path& PATH,
+             variables& vs) {
+              Symbol result = Symbol(false, Type::Boolean);
               for (auto e: args) {
                 if (e.type != Type::List) {
                   throw std::logic_error {
                     "Wrong expression in 'cond'! Expected "
                     "[<clause> <consequent>].\n" };
                 }
-                auto l = std::get<std::list<Symbol>>(e.value);
+                auto l = std::get<List>(e.value);
                 if (l.size() < 2) {
                   throw std::logic_error {
                     "Wrong expression in 'cond'! Expected "
@@ -422,55 +431,19 @@ std::map<std::string, Functor> branching = {
 		}
               }
               return result;
-            }}},
-  std::pair{"match", Functor{[](std::list<Symbol> args, const path& PATH, variables& vs) {
+            }},
+  Builtin{"match", [](List args, const path& PATH, variables& vs) {
     Symbol matched = args.front();
     args.pop_front();
     matched = eval(matched, PATH, vs);
+    // the captures are local to the arm
+    variables scope{&vs};
+    auto body = select_match_arm(matched, args, scope, PATH);
+    if (body == std::nullopt)
+      return Symbol(false, Type::Boolean);
     Symbol result;
-    for (auto e : args) {
-      auto l = std::get<std::list<Symbol>>(e.value);
-      auto pat = l.front();
-      l.pop_front();
-
-      // a special rule for the 'any' ("_") fallback pattern.
-      if (pat.type == Type::Identifier)
-	if (std::get<std::string>(pat.value) == "_") {
-	  vs.insert({"_", matched});
-	  for (auto x : l)
-	    result = eval(x, PATH, vs);
-	  return result;
-	}
-      
-      if ((pat.type != Type::List)) {
-	if (pat.value == matched.value) {
-	  for (auto x : l) {
-	    result = eval(x, PATH, vs);
-	  }
-	  return result;
-	}
-      }
-      auto x = std::get<std::list<Symbol>>(pat.value);
-      if ((matched.type == Type::List) || (matched.type == Type::ListLiteral)) {
-	if ((pat.type == Type::ListLiteral) &&
-	    compare_list_structure(pat, matched)) {
-	  auto ps = rec_bind_list(pat, matched);
-	  for (auto [var, val] : ps) {
-	    vs.insert({std::get<std::string>(var.value), val});
-	  }
-	  for (auto x : l)
-	    result = eval(x, PATH, vs);
-	  return result;
-	}
-      }
-      for (auto [k, v] : patterns) {
-	if (weak_compare(pat, k)) {
-	  auto opt = v(matched, x, vs, PATH, l);
-	  if (opt == std::nullopt) break;
-	  return *opt;
-	}
-      }
-    }
-    return Symbol("", false, Type::Boolean);
-  }}}
+    for (auto x : *body)
+      result = eval(x, PATH, scope);
+    return result;
+  }}
 };
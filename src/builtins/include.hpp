@@ -4,17 +4,141 @@
 #include "string.hpp"
 #include "numeric.hpp"
 #include "list.hpp"
+#include "maps.hpp"
 #include "boolean.hpp"
 #include "misc.hpp"
 #include "source.hpp"
 #include "shell.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
 
-static std::map<std::string, Functor> procedures =
-  combine(branching,
-	  combine(io,
-		  combine(string,
-			  combine(numeric,
-				  combine(list,
-					  combine(code,
-						  combine(boolean,
-							  combine(misc, shell))))))));
+// The builtin table is laid out at compile time: the tables of every module
+// are concatenated into a single array, and a perfect hash maps each name to
+// its entry, so a name lookup is one hash and one comparison.
+
+template <std::size_t... N>
+constexpr auto concat(const Builtin (&... tables)[N]) {
+  std::array<Builtin, (N + ...)> all;
+  std::size_t i = 0;
+  ((std::copy(std::begin(tables), std::end(tables), all.begin() + i),
+    i += N), ...);
+  return all;
+}
+
+constexpr auto builtins =
+  concat(branching, io, string, numeric, list, maps, code, boolean, misc,
+         shell, parallel);
+
+// seeded FNV-1a
+constexpr std::uint32_t builtin_hash(std::string_view s, std::uint32_t seed) {
+  std::uint32_t h = 2166136261u ^ seed;
+  for (char c : s)
+    h = (h ^ static_cast<unsigned char>(c)) * 16777619u;
+  return h;
+}
+
+// the slots hold an index into 'builtins' plus one, 0 is an empty slot.
+constexpr std::size_t builtin_slots = 512;
+static_assert(builtins.size() < 256);
+
+struct BuiltinHash {
+  std::uint32_t seed = 0;
+  std::array<std::uint8_t, builtin_slots> slots{};
+};
+
+// tries seeds until no two names share a slot. Two builtins with the same
+// name never stop colliding, which makes this a compile error.
+constexpr BuiltinHash perfect_hash() {
+  for (std::uint32_t seed = 0; seed < 4096; ++seed) {
+    BuiltinHash h{.seed = seed};
+    bool ok = true;
+    for (std::size_t i = 0; ok && (i < builtins.size()); ++i) {
+      auto& slot = h.slots[builtin_hash(builtins[i].name, seed) %
+                           builtin_slots];
+      ok = (slot == 0);
+      slot = i + 1;
+    }
+    if (ok)
+      return h;
+  }
+  throw std::logic_error{"no perfect hash for the builtin names!"};
+}
+
+constexpr BuiltinHash builtin_index = perfect_hash();
+
+// nullptr if there's no builtin with that name
+constexpr const Builtin* builtin(std::string_view name) {
+  auto i = builtin_index.slots[builtin_hash(name, builtin_index.seed) %
+                               builtin_slots];
+  if ((i == 0) || (builtins[i - 1].name != name))
+    return nullptr;
+  return &builtins[i - 1];
+}
+
+static_assert(builtin("cond") != nullptr);
+static_assert(builtin("no such builtin") == nullptr);
+
+// builtins whose result only depends on their arguments. The compiler
+// folds their calls on constants, see Compiler::fold_call().
+constexpr std::string_view pure_builtins[] = {
+  "+", "-", "*", "/", "%", "<", "=", "!=", "not", "s+", "toi", "tos",
+  "chtoi", "stol", "hd", "tl", "reverse", "delete", "insert", "++",
+  "length", "ltos", "sum", "product", "min", "max", "mean", "dot",
+  "map-get", "map-has", "map-put", "map-remove", "map-keys", "map-values",
+  "map-size", "ltom", "mtol"};
+
+static_assert(std::ranges::all_of(pure_builtins, [](std::string_view n) {
+  return (builtin(n) != nullptr) && (builtin(n)->conv == Conv::Args);
+}));
+
+bool is_pure(const Builtin& b) {
+  return std::ranges::find(pure_builtins, b.name) != std::end(pure_builtins);
+}
+
+// the same table, indexed by the interned id of the names.
+static std::vector<const Builtin*> builtins_by_id = [] {
+  std::vector<const Builtin*> table;
+  for (auto& b : builtins) {
+    SymbolId id = intern(b.name);
+    if (id >= table.size())
+      table.resize(id + 1, nullptr);
+    table[id] = &b;
+  }
+  return table;
+}();
+
+const Builtin* procedure(SymbolId id) {
+  if ((id < builtins_by_id.size()) && (builtins_by_id[id] != nullptr))
+    return builtins_by_id[id];
+  return interp().host_builtin(id);
+}
+
+void Interpreter::define_builtin(std::string_view name,
+                                 Builtin::native_type fn, int arity) {
+  SymbolId id = intern(name);
+  if (procedure(id) != nullptr)
+    throw std::logic_error{"'" + std::string{name} +
+                           "' is already a builtin!\n"};
+  auto& b = host_builtins[id];
+  b.fn = std::move(fn);
+  b.entry = Builtin::host(symbol_name(id), &b.fn, arity);
+  // the call caches may have missed it before
+  binding_version = next_binding_version();
+}
+
+// throws unless the builtin accepts n arguments
+void check_arity(const Builtin& b, std::size_t n) {
+  if ((b.arity == Builtin::variadic) || (std::size_t(b.arity) == n))
+    return;
+  throw std::logic_error{"'" + std::string{b.name} + "' expects " +
+                         std::to_string(b.arity) +
+                         ((b.arity == 1) ? " argument" : " arguments") +
+                         ", but " + std::to_string(n) +
+                         ((n == 1) ? " was" : " were") + " given!\n"};
+}
@@ -3,41 +3,44 @@
 
 // functions on lists
 
-std::map<std::string, Functor> list = {
-    std::pair{"hd", Functor{[](std::list<Symbol> args) -> Symbol {
+constexpr Builtin list[] = {
+    Builtin{"hd", [](List args) -> Symbol {
       if ((args.front().type != Type::List) && (args.front().type != Type::ListLiteral))
         throw std::logic_error {"'hd': Expected a list!\n"};
-      auto l = std::get<std::list<Symbol>>(args.front().value);
+      const auto& l = std::get<List>(args.front().value);
+      if (l.empty())
+        throw std::logic_error {"'hd': Expected a non-empty list!\n"};
       return l.front();
-    }}},
-    std::pair{"tl", Functor{[](std::list<Symbol> args) -> Symbol {
+    }, 1},
+    Builtin{"tl", [](List args) -> Symbol {
       if ((args.front().type != Type::List) && (args.front().type != Type::ListLiteral))
         throw std::logic_error {"'tl': Expected a list!\n"};
-      auto l = std::get<std::list<Symbol>>(args.front().value);
+      auto l = std::get<List>(args.front().value);
+      if (l.empty())
+        throw std::logic_error {"'tl': Expected a non-empty list!\n"};
       l.pop_front();
-      return Symbol("", l, Type::List);
-    }}},
-    std::pair{"reverse", Functor{[](std::list<Symbol> args) -> Symbol {
+      return Symbol(l, Type::List);
+    }, 1},
+    Builtin{"reverse", [](List args) -> Symbol {
       if ((args.front().type != Type::List) && (args.front().type != Type::ListLiteral))
         throw std::logic_error {"'reverse': Expected a list!\n"};
-      auto l = std::get<std::list<Symbol>>(args.front().value);
+      auto l = std::get<List>(args.front().value);
       std::reverse(l.begin(), l.end());
-      return Symbol("", l, Type::List);
-    }}},
-    std::pair{"delete", Functor{[](std::list<Symbol> args) -> Symbol {
+      return Symbol(l, Type::List);
+    }, 1},
+    Builtin{"delete", [](List args) -> Symbol {
       if ((args.front().type != Type::List) && (args.front().type != Type::ListLiteral))
         throw std::logic_error {"'delete': Expected a list as"
                                 " first argument!\n"};
-      auto l = std::get<std::list<Symbol>>(args.front().value);
+      auto l = std::get<List>(args.front().value);
       args.pop_front();
       long long signed int idx =
         std::visit(overloaded{
           [](long long int n) -> long long int { return n; },
-          [](long long unsigned int n) -> long long int {
-            return n;
-          },
           [](auto) -> long long int { return 0; }
         }, args.front().value);
+      if ((idx < 0) || (idx >= static_cast<long long int>(l.size())))
+        throw std::logic_error {"'delete': Index out of range!\n"};
       long long int i = 0;
       auto it = l.begin();
       while (i < idx) {
@@ -45,15 +48,13 @@ std::map<std::string, Functor> list = {
         i++;
       }
       l.erase(it);
-      return Symbol("", l, Type::List);
-    }}},
-    std::pair{"insert", Functor{[](std::list<Symbol> args) -> Symbol {
-      if (args.size() != 3)
-        throw std::logic_error {"'insert': expected 3 argumets!\n"};
+      return Symbol(l, Type::List);
+    }, 2},
+    Builtin{"insert", [](List args) -> Symbol {
       if ((args.front().type != Type::List) && (args.front().type != Type::ListLiteral))
         throw std::logic_error {"'insert': Expected a list as"
                                 " first argument!\n"};
-      auto l = std::get<std::list<Symbol>>(args.front().value);
+      auto l = std::get<List>(args.front().value);
       args.pop_front();
       if (args.front().type != Type::Number)
         throw std::logic_error {"'insert': second argument "
@@ -61,12 +62,11 @@ std::map<std::string, Functor> list = {
       long long signed int idx =
         std::visit(overloaded{
           [](long long int n) -> long long int { return n; },
-          [](long long unsigned int n) -> long long int {
-            return n;
-          },
           [](auto) -> long long int { return 0; }
         }, args.front().value);
       args.pop_front();
+      if ((idx < 0) || (idx > static_cast<long long int>(l.size())))
+        throw std::logic_error {"'insert': Index out of range!\n"};
       long long int i = 0;
       auto it = l.begin();
       while (i < idx) {
@@ -74,15 +74,13 @@ std::map<std::string, Functor> list = {
         i++;
       }
       l.insert(it, args.front());
-      return Symbol("", l, Type::List);
-    }}},
-    std::pair{"ltos", Functor{[](std::list<Symbol> args) -> Symbol {
-      if (args.size() != 1)
-        throw std::logic_error {"'ltos': Expected one argument!\n"};
+      return Symbol(l, Type::List);
+    }, 3},
+    Builtin{"ltos", [](List args) -> Symbol {
       if ((args.front().type != Type::List) && (args.front().type != Type::ListLiteral))
         throw std::logic_error {"'ltos': Expected a list!\n"};
       std::string s;
-      for (auto x : std::get<std::list<Symbol>>(args.front().value)) {
+      for (auto x : std::get<List>(args.front().value)) {
         if ((x.type == Type::String) ||
             (x.type == Type::Identifier))
           s += std::get<std::string>(x.value);
@@ -91,42 +89,44 @@ std::map<std::string, Functor> list = {
             "'ltos': expected a list of strings!\n"
           };
       }
-      return Symbol("", s, Type::String);
-    }}},
-    std::pair{"ltof", Functor{[](std::list<Symbol> args) -> Symbol {
-      if (args.size() != 1)
-        throw std::logic_error {"'ltof': Expected one argument!\n"};
+      return Symbol(s, Type::String);
+    }, 1},
+    Builtin{"ltof", [](List args) -> Symbol {
       if ((args.front().type != Type::List) && (args.front().type != Type::ListLiteral))
         throw std::logic_error {"'ltof': Expected a list!\n"};
-      auto l = std::get<std::list<Symbol>>(args.front().value);
+      const auto& l = std::get<List>(args.front().value);
       if (l.size() != 2)
 	throw std::logic_error {"'ltof': The correct format is '[<arguments> <body>]"};
-      return Symbol("", args.front().value, Type::Function);
-    }}},
-    std::pair{"++", Functor{[](std::list<Symbol> args) -> Symbol {
-      std::list<Symbol> l;
-      for (auto x : args) {
+      return Symbol(args.front().value, Type::Function);
+    }, 1},
+    Builtin{"++", [](List args) -> Symbol {
+      // appending to the first list shares its buffer, when we can.
+      List l;
+      for (auto& x : std::as_const(args)) {
         if ((x.type == Type::List) || (x.type == Type::ListLiteral)) {
-          auto r = std::get<std::list<Symbol>>(x.value);
-          l.insert(l.end(), r.begin(), r.end());
-        } else l.push_back(x);
+          const auto& r = std::get<List>(x.value);
+          if (l.empty())
+            l = r;
+          else
+            l.append(r);
+        } else l.append(x);
       }
-      return Symbol("", l, Type::List);
-    }}},
-    std::pair{"length", Functor{[](std::list<Symbol> args) -> Symbol {
+      return Symbol(l, Type::List);
+    }},
+    Builtin{"length", [](List args) -> Symbol {
       if (args.empty()) {
-	return Symbol("", 0, Type::Number);
+	return Symbol(0, Type::Number);
       }
-      if ((!std::holds_alternative<std::list<Symbol>>(args.front().value)) ||
+      if ((!std::holds_alternative<List>(args.front().value)) ||
 	  (args.size() > 1)) {
 	throw std::logic_error{"'length' expects a list of which to return "
                                "the length!\n"};
       }
-      auto lst = std::get<std::list<Symbol>>(args.front().value);
+      const auto& lst = std::get<List>(args.front().value);
       if (lst.empty()) {
-	return Symbol("", 0, Type::Number);
+	return Symbol(0, Type::Number);
       }
-      return Symbol("", static_cast<long long unsigned int>(lst.size()),
+      return Symbol(static_cast<long long int>(lst.size()),
                     Type::Number);
-    }}}
+    }}
 };
@@ -0,0 +1,78 @@
+#pragma once
+#include "../include.hpp"
+#include "../map.hpp"
+
+// the hash maps, see map.hpp. The updates leave the map they're given as
+// it is, and return a new one.
+
+const Map& map_arg(std::string_view name, const Symbol& s) {
+  if (!std::holds_alternative<Map>(s.value))
+    throw std::logic_error{"'" + std::string{name} +
+                           "': Expected a map as first argument!\n"};
+  return std::get<Map>(s.value);
+}
+
+constexpr Builtin maps[] = {
+  // (map-get m k) or (map-get m k default)
+  Builtin{"map-get", [](List args) -> Symbol {
+    if ((args.size() < 2) || (args.size() > 3))
+      throw std::logic_error{"'map-get': Expected a map, a key and an "
+                             "optional default value!\n"};
+    if (auto v = map_arg("map-get", args[0]).find(args[1]))
+      return *v;
+    if (args.size() == 3)
+      return args[2];
+    throw std::logic_error{"'map-get': No value for the key " +
+                           rec_print_ast(args[1]) + "!\n"};
+  }},
+  Builtin{"map-has", [](List args) -> Symbol {
+    return Symbol(map_arg("map-has", args[0]).find(args[1]) != nullptr,
+                  Type::Boolean);
+  }, 2},
+  // (map-put m k v)
+  Builtin{"map-put", [](List args) -> Symbol {
+    return Symbol(map_arg("map-put", args[0]).insert(args[1], args[2]),
+                  Type::Map);
+  }, 3},
+  Builtin{"map-remove", [](List args) -> Symbol {
+    return Symbol(map_arg("map-remove", args[0]).erase(args[1]), Type::Map);
+  }, 2},
+  Builtin{"map-keys", [](List args) -> Symbol {
+    List keys;
+    map_arg("map-keys", args[0]).for_each(
+        [&](const Symbol& k, const Symbol&) { keys.push_back(k); });
+    return Symbol(keys, Type::List);
+  }, 1},
+  Builtin{"map-values", [](List args) -> Symbol {
+    List values;
+    map_arg("map-values", args[0]).for_each(
+        [&](const Symbol&, const Symbol& v) { values.push_back(v); });
+    return Symbol(values, Type::List);
+  }, 1},
+  Builtin{"map-size", [](List args) -> Symbol {
+    return Symbol(
+        static_cast<long long int>(map_arg("map-size", args[0]).size()),
+        Type::Number);
+  }, 1},
+  // a map from a list of [key value] pairs
+  Builtin{"ltom", [](List args) -> Symbol {
+    if (!std::holds_alternative<List>(args[0].value))
+      throw std::logic_error{"'ltom': Expected a list of pairs!\n"};
+    Map m;
+    for (auto& p : std::get<List>(args[0].value)) {
+      auto kv = std::get_if<List>(&p.value);
+      if (!kv || (kv->size() != 2))
+        throw std::logic_error{"'ltom': Expected a list of pairs!\n"};
+      m = m.insert(kv->front(), kv->back());
+    }
+    return Symbol(m, Type::Map);
+  }, 1},
+  // the [key value] pairs of a map
+  Builtin{"mtol", [](List args) -> Symbol {
+    List pairs;
+    map_arg("mtol", args[0]).for_each([&](const Symbol& k, const Symbol& v) {
+      pairs.push_back(Symbol(List{k, v}, Type::List));
+    });
+    return Symbol(pairs, Type::List);
+  }, 1},
+};
@@ -1,95 +1,147 @@
 #pragma once
 #include "../include.hpp"
+#include "../compiler.hpp"
 
-std::map<std::string, Functor> misc = {
-  std::pair{"tokens", Functor{[](std::list<Symbol> args) -> Symbol {
+constexpr Builtin misc[] = {
+  Builtin{"tokens", [](List args) -> Symbol {
     // returns a list of tokens from a single string given as argument,
     // as if it went throught the ordinary lexing of some Rewind input
     // (because this is exactly what we're doing here)
-    if (args.size() != 1) {
-      throw std::logic_error{
-        "The 'tokens' function only accepts a single string!\n"};
-    }
     if (args.front().type != Type::String) {
       throw std::logic_error{
         "The 'tokens' function only accepts a single string!\n"};
     }
     std::vector<Token> tks =
       get_tokens(std::get<std::string>(args.front().value));
-    auto ret = std::list<Symbol>();
+    auto ret = List();
     for (auto tk : tks) {
-      ret.push_back(Symbol("", tk.tk, Type::String));
+      ret.push_back(Symbol(std::string{tk.tk}, Type::String));
     }
-    return Symbol("", ret, Type::List, true);
-  }}},
-  std::pair{"ast", Functor{[](std::list<Symbol> args) -> Symbol {
-    if (args.size() != 1)
-      throw std::logic_error {"The 'ast' function accepts a single list of tokens!\n"};
+    return Symbol(ret, Type::List, true);
+  }, 1},
+  Builtin{"ast", [](List args) -> Symbol {
     if ((args.front().type != Type::List) && (args.front().type != Type::ListLiteral))
       throw std::logic_error {"The 'ast' function accepts a single list of tokens!\n"};
-    auto l = std::get<std::list<Symbol>>(args.front().value);
+    const auto& l = std::get<List>(args.front().value);
     std::vector<Token> tks;
-    for (auto x : l) {
+    for (const auto& x : l) {
       tks.push_back(Token {.tk = std::get<std::string>(x.value),
                           .line = x.line });
     }
     try {
       Symbol ast = parse(tks);
       if (ast.type != Type::List) return ast;
-      auto l = std::get<std::list<Symbol>>(ast.value);
+      const auto& l = std::get<List>(ast.value);
       if (l.empty()) return ast;
       return l.front();
     } catch (std::logic_error e) {
-      return Symbol("", std::list<Symbol>{}, Type::List);
+      return Symbol(List{}, Type::List);
+    }
+  }, 1},
+  Builtin{"gc-stats", [](List args) -> Symbol {
+    // counters of the list heap of this thread (see heap.hpp), as a list
+    // of (name value) pairs
+    const HeapStats& st = heap().stats;
+    auto ret = List();
+    for (auto [name, n] : {std::pair{"allocated", st.allocated},
+                           std::pair{"freed", st.freed},
+                           std::pair{"returned", st.returned},
+                           std::pair{"reused", st.reused},
+                           std::pair{"chunks", st.chunks},
+                           std::pair{"large", st.large}}) {
+      ret.push_back(Symbol(
+          List{Symbol(name, Type::String),
+               Symbol(static_cast<long long int>(n), Type::Number)},
+          Type::List));
     }
-  }}},
-  std::pair{"typeof", Functor{[](std::list<Symbol> args) -> Symbol {
-    if (args.size() != 1) {
+    return Symbol(ret, Type::List);
+  }, 0},
+  // (memo f) or (memo f n): f, remembering the result of every call by its
+  // arguments (see memo.hpp), at most n of them if given. f should be pure.
+  // Only the calls to the function returned are remembered, so for a
+  // recursive f to use its own results, its body must call it by that name.
+  Builtin{"memo", [](List args) -> Symbol {
+    if ((args.size() < 1) || (args.size() > 2) ||
+        (args.front().type != Type::Function))
       throw std::logic_error{
-        "The 'typeof' procedure expects exactly one symbol!\n"};
+          "'memo': Expected a function and an optional size!\n"};
+    std::size_t capacity = 0;
+    if (args.size() == 2) {
+      auto n = std::get_if<long long int>(&args.back().value);
+      if (!n || (*n < 1))
+        throw std::logic_error{"'memo': Expected a positive size!\n"};
+      capacity = *n;
     }
-
+    Symbol f = args.front();
+    auto code = f.code ? f.code : compile_function(f);
+    if (code == nullptr)
+      throw std::logic_error{"'memo': Can't memoize " + rec_print_ast(f) +
+                             "!\n"};
+    // a copy of the code, so f itself still calls through
+    auto memoized = std::make_shared<Chunk>(*code);
+    memoized->memo = std::make_shared<MemoTable>(capacity);
+    f.code = memoized;
+    return f;
+  }},
+  Builtin{"memo-stats", [](List args) -> Symbol {
+    // counters of a function returned by 'memo', as a list of (name value)
+    // pairs like 'gc-stats'
+    const Symbol& f = args.front();
+    if ((f.type != Type::Function) || !f.code || !f.code->memo)
+      throw std::logic_error{"'memo-stats': Expected a memoized function!\n"};
+    MemoStats st = f.code->memo->stats();
+    auto ret = List();
+    for (auto [name, n] : {std::pair{"hits", st.hits},
+                           std::pair{"misses", st.misses},
+                           std::pair{"evictions", st.evictions},
+                           std::pair{"size", st.size}}) {
+      ret.push_back(Symbol(
+          List{Symbol(name, Type::String),
+               Symbol(static_cast<long long int>(n), Type::Number)},
+          Type::List));
+    }
+    return Symbol(ret, Type::List);
+  }, 1},
+  Builtin{"typeof", [](List args) -> Symbol {
     Symbol ast;
     if (args.front().type == Type::RawAst) {
-      ast = parse(get_tokens(rec_print_ast(args.front())));
-      ast = std::get<std::list<Symbol>>(ast.value).front();
+      auto source = rec_print_ast(args.front());
+      ast = parse(get_tokens(source));
+      ast = std::get<List>(ast.value).front();
     } else
       ast = args.front();
     switch (ast.type) {
     case Type::List:
-      return Symbol("", "list", Type::String);
+      return Symbol("list", Type::String);
       break;
     case Type::Number:
-      return Symbol("", "number", Type::String);
+      return Symbol("number", Type::String);
+      break;
+    case Type::Map:
+      return Symbol("map", Type::String);
       break;
     case Type::Identifier:
-      return Symbol("", "identifier", Type::String);
+      return Symbol("identifier", Type::String);
       break;
     case Type::String:
-      return Symbol("", "string", Type::String);
+      return Symbol("string", Type::String);
       break;
     case Type::Boolean:
-      return Symbol("", "boolean", Type::String);
+      return Symbol("boolean", Type::String);
       break;
     case Type::Operator:
-      return Symbol("", "operator", Type::String);
+      return Symbol("operator", Type::String);
       break;
     case Type::Error:
-      return Symbol("", "error", Type::String);
+      return Symbol("error", Type::String);
     default:
-      return Symbol("", "undefined", Type::String);
+      return Symbol("undefined", Type::String);
     }
-  }}},
-  std::pair{"return", Functor{[](std::list<Symbol> args) {
-    if (args.size() != 1)
-      throw std::logic_error {"The 'return' builtin expects one argument!\n"};
+  }, 1},
+  Builtin{"return", [](List args) {
     return args.front();
-  }}},
-  std::pair{"defined", Functor{[](std::list<Symbol> args, path PATH, variables vars) -> Symbol {
-    if (args.size() != 1) {
-      throw std::logic_error{"the 'defined' boolean procedure expects "
-                             "exactly one name to look up!\n"};
-    }
+  }, 1},
+  Builtin{"defined", [](List args, const path& PATH, variables& vars) -> Symbol {
     Symbol maybe_eval;
     std::string name;
     if ((args.front().type != Type::String) &&
@@ -105,11 +157,11 @@ std::map<std::string, Functor> misc = {
         throw std::logic_error{"the 'defined' boolean procedure expects an "
                                "identifier or a string!\n"};
     } else name = std::get<std::string>(args.front().value);
-    if (constants.contains(name)) return Symbol("", true, Type::Boolean);
-    if (vars.contains(name)) return Symbol("", true, Type::Boolean);
-    return Symbol("", false, Type::Boolean);
-  }}},
-  std::pair{"let", Functor{[](std::list<Symbol> args, path PATH, variables& vars) -> Symbol {
+    if (interp().constants.contains(name)) return Symbol(true, Type::Boolean);
+    if (vars.contains(name)) return Symbol(true, Type::Boolean);
+    return Symbol(false, Type::Boolean);
+  }, 1},
+  Builtin{"let", [](List args, const path& PATH, variables& vars) -> Symbol {
     Symbol global = args.front();
     args.pop_front();
     Symbol id = args.front();
@@ -117,9 +169,9 @@ std::map<std::string, Functor> misc = {
     args.pop_front();
     Symbol result = eval(args.front(), PATH, vars);
     if (std::get<bool>(global.value)) {
-      constants.insert(std::pair{s, result});
+      interp().constants.insert(std::pair{s, result});
     } else
       vars.insert(std::pair{s, result});
-    return Symbol("", true, Type::Command);
-  }}}
+    return Symbol(true, Type::Command);
+  }}
 };
@@ -1,145 +1,296 @@
 #pragma once
 #include "../include.hpp"
+#include "../simd.hpp"
+#include <cmath>
+#include <compare>
+#include <functional>
+#include <limits>
+#include <optional>
 #include <utility>
+#include <vector>
 
-using ints = std::variant<long long int, long long unsigned int>;
+// the integer operands are int64s, and arithmetic stays on them until a
+// result overflows. From then on it's carried out on BigInts, and the
+// result is turned back into an int64 if it fits (see make_number()). As
+// soon as a double is involved, the rest is done on doubles.
 
-ints get_int(_Type n) {
-  return std::visit(
-      []<class T>(T t) -> ints {
-        if constexpr (std::is_same_v<T, long long unsigned int> ||
-                      std::is_same_v<T, long long signed int>) {
-          return t;
-        }
-        return 0;
-      },
-      n);
+BigInt to_big(const Symbol& n) {
+  if (auto x = std::get_if<long long int>(&n.value))
+    return *x;
+  return std::get<BigInt>(n.value);
 }
 
-std::map<std::string, Functor> numeric = {
-  std::pair{"+", Functor{[](std::list<Symbol> args) -> Symbol {
-    int r = 0;
-    for (auto e : args) {
-      if (e.type == Type::Defunc)
-        continue;
-      if (e.type != Type::Number) {
-        throw std::logic_error{"Unexpected operand to the '+' procedure!\n"};
-      }
-      if (std::holds_alternative<long long int>(e.value))
-        r += std::get<long long int>(e.value);
-      else
-        r += std::get<long long unsigned int>(e.value);
-    }
-    Symbol ret("", r, Type::Number);
-    return ret;
-  }}},
-  std::pair{"-", Functor{[](std::list<Symbol> args) -> Symbol {
-    long long int r;
-    if (args.front().type != Type::Number) {
-      throw std::logic_error{"Unexpected operand to the '-' procedure!\n"};
+double to_double(const Symbol& n) {
+  if (auto x = std::get_if<long long int>(&n.value))
+    return *x;
+  if (auto x = std::get_if<double>(&n.value))
+    return *x;
+  return std::get<BigInt>(n.value).to_double();
+}
+
+std::partial_ordering compare_numbers(const Symbol& a, const Symbol& b) {
+  auto x = std::get_if<long long int>(&a.value);
+  auto y = std::get_if<long long int>(&b.value);
+  if (x && y)
+    return *x <=> *y;
+  if (std::holds_alternative<double>(a.value) ||
+      std::holds_alternative<double>(b.value))
+    return to_double(a) <=> to_double(b);
+  return to_big(a) <=> to_big(b);
+}
+
+// folds 'args' into the first one (or into 0, if 'from_zero' is set).
+// 'fast' works on int64s and returns true on overflow, like the
+// __builtin_*_overflow functions, 'slow' works on both BigInts and
+// doubles.
+template <class Fast, class Slow>
+Symbol arith(std::string_view name, const List& args, Fast fast, Slow slow,
+             bool from_zero = false) {
+  long long int r = 0;
+  std::optional<BigInt> big;
+  std::optional<double> dbl;
+  bool first = !from_zero;
+  for (const auto& e : args) {
+    if (e.type == Type::Defunc)
+      continue;
+    if (e.type != Type::Number) {
+      throw std::logic_error{"Unexpected operand to the '" +
+                             std::string(name) + "' procedure!\n"};
     }
-    if (std::holds_alternative<long long int>(args.front().value))
-      r = std::get<long long int>(args.front().value);
-    else
-      r = std::get<long long unsigned int>(args.front().value);
-    args.pop_front();
-    for (auto e : args) {
-      if (e.type == Type::Defunc)
-        continue;
-      if (e.type != Type::Number) {
-        throw std::logic_error{"Unexpected operand to the '-' procedure!\n"};
-      }
-      if (std::holds_alternative<long long int>(e.value))
-        r -= std::get<long long int>(e.value);
+    auto x = std::get_if<long long int>(&e.value);
+    if (first) {
+      first = false;
+      if (x)
+        r = *x;
+      else if (auto d = std::get_if<double>(&e.value))
+        dbl = *d;
       else
-        r -= std::get<long long unsigned int>(e.value);
+        big = std::get<BigInt>(e.value);
+      continue;
     }
-    Symbol ret("", r, Type::Number);
-    return ret;
-  }}},
-  std::pair{"/", Functor{[](std::list<Symbol> args) -> Symbol {
-    int r;
-    if (args.front().type != Type::Number) {
-      throw std::logic_error{"Unexpected operand to the '/' procedure!\n"};
+    if (!dbl && std::holds_alternative<double>(e.value))
+      dbl = big ? big->to_double() : static_cast<double>(r);
+    if (dbl) {
+      *dbl = slow(*dbl, to_double(e));
+      continue;
     }
-    if (std::holds_alternative<long long int>(args.front().value))
-
-      r = std::get<long long int>(args.front().value);
-    else
-      r = std::get<long long unsigned int>(args.front().value);
-    args.pop_front();
-    for (auto e : args) {
-      if (e.type == Type::Defunc)
-        continue;
-      if (e.type != Type::Number) {
-        throw std::logic_error{"Unexpected operand to the '/' procedure!\n"};
-      }
-      if (std::holds_alternative<long long int>(e.value))
-        r /= std::get<long long int>(e.value);
-      else
-        r /= std::get<long long unsigned int>(e.value);
+    long long int t;
+    if (!big && x && !fast(r, *x, &t)) {
+      r = t;
+      continue;
     }
-    Symbol ret("", r, Type::Number);
-    return ret;
-  }}},
-  std::pair{"%", Functor{[](std::list<Symbol> args) -> Symbol {
-    if ((args.size() != 2) || (args.front().type != args.back().type) ||
+    if (!big)
+      big = BigInt(r);
+    *big = slow(*big, to_big(e));
+  }
+  if (dbl)
+    return Symbol(*dbl, Type::Number);
+  if (big)
+    return make_number(std::move(*big));
+  return Symbol(r, Type::Number);
+}
+
+void check_divisor(bool is_zero) {
+  if (is_zero)
+    throw std::logic_error{"Division by zero!\n"};
+}
+
+// the list argument of the reductions below, which must only hold numbers.
+// Sets 'doubles' if any of them is a double, in which case the list is
+// reduced as doubles with the kernels of simd.hpp. Otherwise it keeps the
+// exact integer arithmetic of arith().
+const List& numbers(std::string_view name, const Symbol& arg, bool& doubles) {
+  auto l = std::get_if<List>(&arg.value);
+  bool ok = l != nullptr;
+  doubles = false;
+  for (std::size_t i = 0; ok && (i < l->size()); ++i) {
+    ok = (*l)[i].type == Type::Number;
+    doubles = doubles || std::holds_alternative<double>((*l)[i].value);
+  }
+  if (!ok)
+    throw std::logic_error{"'" + std::string(name) +
+                           "' expects a list of numbers!\n"};
+  return *l;
+}
+
+std::vector<double> to_doubles(const List& l) {
+  std::vector<double> xs;
+  xs.reserve(l.size());
+  for (const auto& x : l)
+    xs.push_back(to_double(x));
+  return xs;
+}
+
+template <Reduction Op>
+Symbol extremum(std::string_view name, const Symbol& arg) {
+  bool doubles;
+  const List& l = numbers(name, arg, doubles);
+  if (l.empty())
+    throw std::logic_error{"'" + std::string(name) +
+                           "' expects a non-empty list!\n"};
+  if (doubles) {
+    auto xs = to_doubles(l);
+    return Symbol(reduce<Op>(xs.data(), xs.size()), Type::Number);
+  }
+  const Symbol* r = &l.front();
+  for (const auto& x : l)
+    if (compare_numbers(x, *r) == ((Op == Reduction::Min)
+                                       ? std::partial_ordering::less
+                                       : std::partial_ordering::greater))
+      r = &x;
+  return *r;
+}
+
+Symbol sum(const Symbol& arg) {
+  bool doubles;
+  const List& l = numbers("sum", arg, doubles);
+  if (doubles) {
+    auto xs = to_doubles(l);
+    return Symbol(reduce<Reduction::Sum>(xs.data(), xs.size()), Type::Number);
+  }
+  return arith("sum", l,
+               [](long long int a, long long int b, long long int* r) {
+                 return __builtin_add_overflow(a, b, r);
+               },
+               std::plus<>{}, true);
+}
+
+constexpr Builtin numeric[] = {
+  Builtin{"+", [](List args) -> Symbol {
+    return arith("+", args,
+                 [](long long int a, long long int b, long long int* r) {
+                   return __builtin_add_overflow(a, b, r);
+                 },
+                 std::plus<>{}, true);
+  }},
+  Builtin{"-", [](List args) -> Symbol {
+    return arith("-", args,
+                 [](long long int a, long long int b, long long int* r) {
+                   return __builtin_sub_overflow(a, b, r);
+                 },
+                 std::minus<>{});
+  }},
+  Builtin{"/", [](List args) -> Symbol {
+    return arith("/", args,
+                 [](long long int a, long long int b, long long int* r) {
+                   check_divisor(b == 0);
+                   if ((b == -1) &&
+                       (a == std::numeric_limits<long long int>::min()))
+                     return true;
+                   *r = a / b;
+                   return false;
+                 },
+                 []<class T>(const T& a, const T& b) {
+                   if constexpr (std::is_same_v<T, BigInt>)
+                     check_divisor(b.is_zero());
+                   return a / b;
+                 });
+  }},
+  Builtin{"%", [](List args) -> Symbol {
+    if ((args.front().type != args.back().type) ||
         (args.front().type != Type::Number) ||
         (args.back().type != Type::Number)) {
       throw std::logic_error{
-        "Exception: The 'modulus' operator only accepts two integers!\n"};
+        "Exception: The 'modulus' operator only accepts two numbers!\n"};
     }
-    return Symbol("",
-                  std::visit(
-                             [](auto t, auto u) -> long long unsigned int {
-                               return std::modulus<>{}(t, u);
-                             },
-                             get_int(args.front().value),
-                             get_int(args.back().value)),
-                  Type::Number);
-  }}},
-  std::pair{"*", Functor{[](std::list<Symbol> args) -> Symbol {
-    int r;
-    if (args.front().type != Type::Number) {
-      throw std::logic_error{"Unexpected operand to the '*' procedure!\n"};
-    }
-    if (std::holds_alternative<long long int>(args.front().value))
-      r = std::get<long long int>(args.front().value);
-    else
-      r = std::get<long long unsigned int>(args.front().value);
-    args.pop_front();
-    for (auto e : args) {
-      if (e.type == Type::Defunc)
-        continue;
-      if (e.type != Type::Number) {
-        throw std::logic_error{"Unexpected operand to the '*' procedure!\n"};
-      }
-      if (std::holds_alternative<long long int>(e.value))
-        r *= std::get<long long int>(e.value);
-      else
-        r *= std::get<long long unsigned int>(e.value);
-    }
-    Symbol ret("", r, Type::Number);
-    return ret;
-  }}},
-  std::pair{"<", Functor{[](std::list<Symbol> args) -> Symbol {
+    return arith("%", args,
+                 [](long long int a, long long int b, long long int* r) {
+                   check_divisor(b == 0);
+                   *r = (b == -1) ? 0 : a % b;
+                   return false;
+                 },
+                 []<class T>(const T& a, const T& b) {
+                   if constexpr (std::is_same_v<T, BigInt>) {
+                     check_divisor(b.is_zero());
+                     return a % b;
+                   } else
+                     return std::fmod(a, b);
+                 });
+  }, 2},
+  Builtin{"*", [](List args) -> Symbol {
+    return arith("*", args,
+                 [](long long int a, long long int b, long long int* r) {
+                   return __builtin_mul_overflow(a, b, r);
+                 },
+                 std::multiplies<>{});
+  }},
+  Builtin{"<", [](List args) -> Symbol {
     bool is_true = true;
     if (args.empty())
-      return Symbol("", true, Type::Boolean);
+      return Symbol(true, Type::Boolean);
     auto first = args.front();
     args.pop_front();
     for (auto e : args) {
       if ((first.type != Type::Number) || (e.type != Type::Number)) {
-        throw std::logic_error{"The '<' operator only accepts integers!\n"};
+        throw std::logic_error{"The '<' operator only accepts numbers!\n"};
       }
-      // uses (in)equality operator overloads for integer variants
-      is_true = is_true && std::visit(
-				      []<class T, class U>(T t, U u) -> bool {
-					return std::cmp_greater(t, u);
-				      },
-				      get_int(e.value), get_int(first.value));
+      is_true = is_true && (compare_numbers(first, e) < 0);
       first = e;
     }
-    return Symbol("", is_true, Type::Boolean);
-  }}},
+    return Symbol(is_true, Type::Boolean);
+  }},
+  // reductions over a list of numbers
+  Builtin{"sum", [](List args) -> Symbol {
+    return sum(args.front());
+  }, 1},
+  Builtin{"product", [](List args) -> Symbol {
+    bool doubles;
+    const List& l = numbers("product", args.front(), doubles);
+    if (doubles) {
+      auto xs = to_doubles(l);
+      return Symbol(reduce<Reduction::Product>(xs.data(), xs.size()),
+                    Type::Number);
+    }
+    if (l.empty())
+      return Symbol(1, Type::Number);
+    return arith("product", l,
+                 [](long long int a, long long int b, long long int* r) {
+                   return __builtin_mul_overflow(a, b, r);
+                 },
+                 std::multiplies<>{});
+  }, 1},
+  Builtin{"min", [](List args) -> Symbol {
+    return extremum<Reduction::Min>("min", args.front());
+  }, 1},
+  Builtin{"max", [](List args) -> Symbol {
+    return extremum<Reduction::Max>("max", args.front());
+  }, 1},
+  Builtin{"mean", [](List args) -> Symbol {
+    bool doubles;
+    const List& l = numbers("mean", args.front(), doubles);
+    if (l.empty())
+      throw std::logic_error{"'mean' expects a non-empty list!\n"};
+    return Symbol(to_double(sum(args.front())) / l.size(), Type::Number);
+  }, 1},
+  Builtin{"dot", [](List args) -> Symbol {
+    bool xd, yd;
+    const List& x = numbers("dot", args.front(), xd);
+    const List& y = numbers("dot", args.back(), yd);
+    if (x.size() != y.size())
+      throw std::logic_error{"'dot' expects two lists of the same length!\n"};
+    if (xd || yd) {
+      auto xs = to_doubles(x);
+      auto ys = to_doubles(y);
+      return Symbol(reduce_dot(xs.data(), ys.data(), xs.size()),
+                    Type::Number);
+    }
+    long long int r = 0;
+    std::optional<BigInt> big;
+    for (std::size_t i = 0; i < x.size(); ++i) {
+      auto a = std::get_if<long long int>(&x[i].value);
+      auto b = std::get_if<long long int>(&y[i].value);
+      long long int p, q;
+      if (!big && a && b && !__builtin_mul_overflow(*a, *b, &p) &&
+          !__builtin_add_overflow(r, p, &q)) {
+        r = q;
+        continue;
+      }
+      if (!big)
+        big = BigInt(r);
+      *big = *big + to_big(x[i]) * to_big(y[i]);
+    }
+    if (big)
+      return make_number(std::move(*big));
+    return Symbol(r, Type::Number);
+  }, 2},
 };
@@ -0,0 +1,108 @@
+#pragma once
+#include "../include.hpp"
+#include "../pool.hpp"
+#include "boolean.hpp"
+
+// data parallel functions on lists. The list is cut in chunks that run on
+// the thread pool (see pool.hpp), so the function they're given should be
+// pure: it can read the global variables, but what it defines is dropped
+// along with its chunk.
+
+// how many chunks a list of n elements is cut in
+std::size_t parallel_chunk_count(std::size_t n) {
+  return std::min(n, ThreadPool::get().size() * 4);
+}
+
+// calls body(chunk, first, last) for every chunk of a list of n elements,
+// each on an interpreter of its own on top of the caller's. Called from a
+// worker (a parallel builtin inside another), the chunks run one after the
+// other on the same thread.
+template <class F>
+void parallel_chunks(std::size_t n, F body) {
+  std::size_t count = parallel_chunk_count(n);
+  auto bounds = [&](std::size_t c) {
+    return std::pair{n * c / count, n * (c + 1) / count};
+  };
+  if (ThreadPool::on_worker() || (count < 2)) {
+    for (std::size_t c = 0; c < count; ++c) {
+      auto [first, last] = bounds(c);
+      body(c, first, last);
+    }
+    return;
+  }
+  Interpreter& caller = interp();
+  std::vector<ThreadPool::Task> tasks;
+  for (std::size_t c = 0; c < count; ++c) {
+    auto [first, last] = bounds(c);
+    tasks.push_back([&caller, &body, c, first, last] {
+      Interpreter worker(caller);
+      Interpreter::Use use(worker);
+      body(c, first, last);
+    });
+  }
+  ThreadPool::get().run(tasks);
+}
+
+const Symbol& parallel_function_arg(std::string_view name, const Symbol& s) {
+  if (s.type != Type::Function)
+    throw std::logic_error{"'" + std::string{name} +
+                           "': Expected a function as first argument!\n"};
+  return s;
+}
+
+const List& parallel_list_arg(std::string_view name, const Symbol& s) {
+  if (!std::holds_alternative<List>(s.value))
+    throw std::logic_error{"'" + std::string{name} +
+                           "': Expected a list as last argument!\n"};
+  return std::get<List>(s.value);
+}
+
+constexpr Builtin parallel[] = {
+  // (pmap f l): the list of (f x) for every x in l, in order
+  Builtin{"pmap", [](List args, const path& PATH) -> Symbol {
+    const Symbol& f = parallel_function_arg("pmap", args.front());
+    const List& l = parallel_list_arg("pmap", args.back());
+    std::vector<Symbol> results(l.size());
+    parallel_chunks(l.size(), [&](std::size_t, std::size_t first,
+                                  std::size_t last) {
+      for (std::size_t i = first; i < last; ++i)
+        results[i] = apply_function(f, List{l[i]}, PATH);
+    });
+    return Symbol(List(results.begin(), results.end()), Type::List);
+  }, 2},
+  // (pfilter f l): the elements x of l for which (f x) is true, in order
+  Builtin{"pfilter", [](List args, const path& PATH) -> Symbol {
+    const Symbol& f = parallel_function_arg("pfilter", args.front());
+    const List& l = parallel_list_arg("pfilter", args.back());
+    std::vector<char> keep(l.size());
+    parallel_chunks(l.size(), [&](std::size_t, std::size_t first,
+                                  std::size_t last) {
+      for (std::size_t i = first; i < last; ++i)
+        keep[i] = convert_value_to_bool(apply_function(f, List{l[i]}, PATH));
+    });
+    List kept;
+    for (std::size_t i = 0; i < l.size(); ++i)
+      if (keep[i])
+        kept.push_back(l[i]);
+    return Symbol(kept, Type::List);
+  }, 2},
+  // (preduce f init l): folds l with f, starting from init. Every chunk is
+  // folded on its own and the results are folded on the calling thread, so
+  // f must be associative.
+  Builtin{"preduce", [](List args, const path& PATH) -> Symbol {
+    const Symbol& f = parallel_function_arg("preduce", args.front());
+    const List& l = parallel_list_arg("preduce", args.back());
+    std::vector<Symbol> partial(parallel_chunk_count(l.size()));
+    parallel_chunks(l.size(), [&](std::size_t c, std::size_t first,
+                                  std::size_t last) {
+      Symbol acc = l[first];
+      for (std::size_t i = first + 1; i < last; ++i)
+        acc = apply_function(f, List{acc, l[i]}, PATH);
+      partial[c] = acc;
+    });
+    Symbol acc = args[1];
+    for (auto& p : partial)
+      acc = apply_function(f, List{acc, p}, PATH);
+    return acc;
+  }, 3},
+};
@@ -1,9 +1,9 @@
 #include "../include.hpp"
 
-std::map<std::string, Functor> shell = {
-  std::pair{"cd", Functor{[](std::list<Symbol> args) -> Symbol {
-    if ((args.size() != 1) || ((args.front().type != Type::Identifier) &&
-                               (args.front().type != Type::String)))
+constexpr Builtin shell[] = {
+  Builtin{"cd", [](List args) -> Symbol {
+    if ((args.front().type != Type::Identifier) &&
+        (args.front().type != Type::String))
       throw std::logic_error{
         "The 'cd' builtin command expects precisely one path!"};
     auto cur = fs::current_path();
@@ -19,30 +19,20 @@ std::map<std::string, Functor> shell = {
       throw std::logic_error{"Unknown path!\n"};
     }
     setenv("PWD", std::string{fs::current_path()}.c_str(), 1);
-    return Symbol("", fs::current_path(), Type::Command);
-  }}},
-  std::pair{"set", Functor{[](std::list<Symbol> args) -> Symbol {
-    if (args.size() != 2)
-      throw std::logic_error{"The 'set' builtin command expects "
-                             "precisely two arguments!\n"};
+    return Symbol(fs::current_path(), Type::Command);
+  }, 1},
+  Builtin{"set", [](List args) -> Symbol {
     std::string var = std::get<std::string>(args.front().value);
     std::string val = std::get<std::string>(args.back().value);
-    return Symbol("", setenv(var.c_str(), val.c_str(), 1), Type::Number);
-  }}},
-  std::pair{"get", Functor{[](std::list<Symbol> args) -> Symbol {
-    if (args.size() != 1)
-      throw std::logic_error{
-        "The 'get' builtin command expects precisely one argument!"};
+    return Symbol(setenv(var.c_str(), val.c_str(), 1), Type::Number);
+  }, 2},
+  Builtin{"get", [](List args) -> Symbol {
     char *s = std::getenv(std::get<std::string>(args.front().value).c_str());
     if (s)
-      return Symbol("", std::string(s), Type::String);
-    return Symbol("", "Nil", Type::String);
-  }}},
-  std::pair{">", Functor{[](std::list<Symbol> args, path PATH) -> Symbol {
-    if (args.size() != 2) {
-      throw std::logic_error{
-        "Expected exactly two arguments to the '>' operator!\n"};
-    }
+      return Symbol(std::string(s), Type::String);
+    return Symbol("Nil", Type::String);
+  }, 1},
+  Builtin{">", [](List args, const path& PATH) -> Symbol {
     if (args.front().type != Type::String) {
       throw std::logic_error{"Invalid first argument to the '>' operator!\n"
                              "Expected a string!.\n"};
@@ -59,13 +49,9 @@ std::map<std::string, Functor> shell = {
     std::cout.rdbuf(out.rdbuf());
     std::cout << contents;
     std::cout.rdbuf(backup);
-    return Symbol("", true, Type::Command);
-  }}},
-  std::pair{">>", Functor{[](std::list<Symbol> args) -> Symbol {
-    if (args.size() != 2) {
-      throw std::logic_error{
-        "Expected exactly two arguments to the '>>' operator!\n"};
-    }
+    return Symbol(true, Type::Command);
+  }, 2},
+  Builtin{">>", [](List args) -> Symbol {
     if (args.front().type != Type::String) {
       throw std::logic_error{"Invalid first argument to the '>>' operator!\n"
                              "Expected a string!.\n"};
@@ -83,6 +69,6 @@ std::map<std::string, Functor> shell = {
     std::cout.rdbuf(out.rdbuf());
     std::cout << contents;
     std::cout.rdbuf(backup);
-    return Symbol("", true, Type::Command);
-  }}}
+    return Symbol(true, Type::Command);
+  }, 2}
 };
@@ -1,35 +1,93 @@
 #pragma once
 #include "../include.hpp"
+#include "../image.hpp"
 
-std::map<std::string, Functor> code = {
-  std::pair{"load", Functor{[](std::list<Symbol> args, path PATH, variables& vars) -> Symbol {
-    Symbol last_evaluated;
-    Symbol last_expr;
-    for (auto e : args) {
-      if ((e.type != Type::Identifier) && (e.type != Type::String)) {
-        throw std::logic_error{"Arguments to 'load' must be either string "
-                               "literals or barewords!"};
-      }
-      std::string filename = std::get<std::string>(e.value);
+// a top-level form of a file given to 'load', or a function definition
+// left for its first lookup (see bind_pending() in vm.hpp) when 'name' is
+// set
+struct LoadedForm {
+  Symbol form{};
+  SymbolId name = no_symbol;
+  LazyDefinition definition{};
+};
 
-      std::vector<Token> tks = get_tokens(rewind_read_file(filename));
-      Symbol ast;
-      try {
-	ast = parse(tks);
-      } catch (std::logic_error ex) { throw std::logic_error {"(file " +
-                                                              filename + ")" + ex.what() }; }
-      for (auto x : std::get<std::list<Symbol>>(ast.value))
-            try {
-              last_evaluated = eval(x, PATH, vars, x.line);
-            } catch (std::logic_error ex) {
-              throw std::logic_error {"(file " + filename + ")\n" + ex.what()};
-            }
+// parses every form of a file, except the 'let's of functions with a block
+// or a list for their body: those are only recorded as the span of their
+// source, for bind_pending() to parse on their first lookup.
+std::vector<LoadedForm> parse_lazily(std::string_view source,
+                                     const std::string& filename) {
+  auto text = std::make_shared<const std::string>(source);
+  auto tokens = get_tokens(*text);
+  std::vector<LoadedForm> forms;
+  for (int i = 0; i < int(tokens.size()); ++i) {
+    if (int end = skim_function_let(tokens, i); end >= 0) {
+      auto last = tokens[end].offset + tokens[end].tk.size();
+      forms.push_back(LoadedForm{
+          .name = intern(tokens[i + 1].tk),
+          .definition = {text, tokens[i].offset, last, tokens[i].line,
+                         filename}});
+      i = end;
+    } else {
+      auto got = dispatch_parse(tokens, i);
+      got.result.is_global = true;
+      forms.push_back(LoadedForm{.form = got.result});
+      i = got.end_index;
     }
-    return last_evaluated;
-  }}},
+  }
+  return forms;
+}
+
+// 'load' leaves the body of every function for the first time it's called,
+// 'preload' parses and compiles everything right away.
+Symbol load_files(const List& args, const path& PATH, variables& vars,
+                  bool eager) {
+  Symbol last_evaluated;
+  for (auto e : args) {
+    if ((e.type != Type::Identifier) && (e.type != Type::String)) {
+      throw std::logic_error{"Arguments to 'load' must be either string "
+                             "literals or barewords!"};
+    }
+    std::string filename = std::get<std::string>(e.value);
+
+    MappedFile source(filename);
+    std::vector<LoadedForm> forms;
+    try {
+      if (eager) {
+        Symbol ast = parse_cached(source.view());
+        for (auto& x : std::get<List>(ast.value))
+          forms.push_back(LoadedForm{.form = x});
+      } else
+        forms = parse_lazily(source.view(), filename);
+    } catch (std::logic_error ex) { throw std::logic_error {"(file " +
+                                                            filename + ")" + ex.what() }; }
+    auto& globals = interp().constants;
+    for (auto& x : forms)
+      try {
+        if (x.name == no_symbol)
+          last_evaluated = run_toplevel(x.form, PATH, vars);
+        else {
+          // like the 'let' it stands for, it leaves a bound name as it is
+          if (!globals.lazy.contains(x.name) && !globals.contains(x.name))
+            globals.lazy.insert({x.name, x.definition});
+          last_evaluated = Symbol(true, Type::Command);
+        }
+      } catch (std::logic_error ex) {
+        throw std::logic_error {"(file " + filename + ")\n" + ex.what()};
+      }
+  }
+  return last_evaluated;
+}
+
+constexpr Builtin code[] = {
+  Builtin{"load", [](List args, const path& PATH, variables& vars) -> Symbol {
+    return load_files(args, PATH, vars, false);
+  }},
+  Builtin{"preload", [](List args, const path& PATH, variables& vars) -> Symbol {
+    return load_files(args, PATH, vars, true);
+  }},
 
-  std::pair{"eval", Functor{[](std::list<Symbol> args, path PATH) -> Symbol {
-    if ((args.size() != 1) || (args.front().type != Type::String)) {
+  Builtin{"eval", [](List args, const path& PATH) -> Symbol {
+    if (args.front().type != Type::String) {
       throw std::logic_error{
         "'eval' expects exactly one string to evaluate!\n"};
     }
@@ -37,20 +95,20 @@ std::map<std::string, Functor> code = {
     std::string line = std::get<std::string>(args.front().value);
     if ((line == "exit") || (line == "(exit)")) {
       exit(EXIT_SUCCESS);
-      return Symbol("", false, Type::Command);
+      return Symbol(false, Type::Command);
     }
     Symbol ast;
-    variables vars = constants;
+    variables vars{&interp().constants};
     try {
       ast = parse(get_tokens(line));
-      ast = std::get<std::list<Symbol>>(ast.value).front();
-      last_evaluated = eval(ast, PATH, vars, ast.line);
+      ast = std::get<List>(ast.value).front();
+      last_evaluated = run_toplevel(ast, PATH, vars);
       if ((last_evaluated.type != Type::Command) &&
           (last_evaluated.type != Type::CommandResult))
         std::cout << rec_print_ast(last_evaluated);
     } catch (std::logic_error ex) {
-      return Symbol("", ex.what(), Type::Error);
+      return Symbol(ex.what(), Type::Error);
     }
     return last_evaluated;
-  }}},
+  }, 1},
 };
@@ -1,7 +1,7 @@
 #include "../include.hpp"
 
-std::map<std::string, Functor> string = {
-  std::pair{"s+", Functor{[](std::list<Symbol> args) -> Symbol {
+constexpr Builtin string[] = {
+  Builtin{"s+", [](List args) -> Symbol {
     const auto is_strlit = [](const std::string &s) -> bool {
       return (s.size() > 1) && (s[0] == '"') && (s[s.length() - 1] == '"');
     };
@@ -18,37 +18,29 @@ std::map<std::string, Functor> string = {
       }
       ret += std::get<std::string>(e.value);
     }
-    return Symbol("", ret, Type::String);
-  }}},
-  std::pair{"toi", Functor{[](std::list<Symbol> args) -> Symbol {
-    if (args.size() != 1) {
-      throw std::logic_error{"'toi' expects precisely one string to try and "
-                             "convert to an integer!\n"};
-    }
+    return Symbol(ret, Type::String);
+  }},
+  Builtin{"toi", [](List args) -> Symbol {
     if (args.front().type != Type::String) {
       throw std::logic_error{"'toi' expects a string!\n"};
     }
     std::string s = std::get<std::string>(args.front().value);
-    long long unsigned int n = 0;
+    long long int n = 0;
     auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.length(), n);
+    if (ec == std::errc::result_out_of_range) {
+      if (auto big = BigInt::parse(s))
+        return make_number(std::move(*big));
+    }
     if (ec != std::errc()) {
       throw std::logic_error{"Exception in 'toi': Failed to convert the "
                              "string to an integer!\n"};
     }
-    return Symbol("", n, Type::Number);
-  }}},
-  std::pair{"tos", Functor{[](std::list<Symbol> args) -> Symbol {
-    if (args.size() != 1) {
-      throw std::logic_error{
-        "Exception in 'tos': This function accepts only one argument!\n"};
-    }
-    return Symbol("", rec_print_ast(args.front()), Type::String);
-  }}},
-  std::pair{"chtoi", Functor{[](std::list<Symbol> args) -> Symbol {
-    if (args.size() != 1) {
-      throw std::logic_error{
-        "Exception in 'chtoi': The function expects a single character!"};
-    }
+    return Symbol(n, Type::Number);
+  }, 1},
+  Builtin{"tos", [](List args) -> Symbol {
+    return Symbol(rec_print_ast(args.front()), Type::String);
+  }, 1},
+  Builtin{"chtoi", [](List args) -> Symbol {
     if ((args.front().type != Type::Identifier) &&
         (args.front().type != Type::String)) {
       throw std::logic_error{
@@ -59,10 +51,10 @@ std::map<std::string, Functor> string = {
       throw std::logic_error{
         "Exception in 'chtoi': The function expects a single character!"};
     }
-    return Symbol("", static_cast<long long signed int>(s[0]), Type::Number);
-  }}},
-  std::pair{"stoid", Functor{[](std::list<Symbol> args) -> Symbol {
-    if ((args.size() != 1) || (args.front().type != Type::String)) {
+    return Symbol(static_cast<long long signed int>(s[0]), Type::Number);
+  }, 1},
+  Builtin{"stoid", [](List args) -> Symbol {
+    if (args.front().type != Type::String) {
       throw std::logic_error{
         "The 'stoid' function accepts a single string!\n"};
     }
@@ -73,14 +65,14 @@ std::map<std::string, Functor> string = {
     if (is_strlit(s)) {
       s = s.substr(1, s.size() - 2);
     }
-    return Symbol("", s, args.front().type);
-  }}},
-  std::pair{"stol", Functor{[](std::list<Symbol> args) -> Symbol {
+    return Symbol(s, args.front().type);
+  }, 1},
+  Builtin{"stol", [](List args) -> Symbol {
     const auto is_strlit = [](const std::string &s) -> bool {
       return (s.size() > 1) && (s[0] == '"') && (s[s.size() - 1] == '"');
     };
 
-    if ((args.size() > 1) || (args.front().type != Type::String)) {
+    if ((args.size() != 1) || (args.front().type != Type::String)) {
       throw std::logic_error{
         "'stol' expects a single string to turn into a list!\n"};
     }
@@ -88,10 +80,10 @@ std::map<std::string, Functor> string = {
     if (is_strlit(s)) {
       s = s.substr(1, s.size() - 2);
     }
-    std::list<Symbol> l;
+    List l;
     for (auto ch : s) {
-      l.push_back(Symbol("", std::string{ch}, Type::String));
+      l.push_back(Symbol(std::string{ch}, Type::String));
     }
-    return Symbol("", l, Type::List, true);
-  }}},
+    return Symbol(l, Type::List, true);
+  }},
 };
@@ -0,0 +1,537 @@
+#pragma once
+// Copyright 2023 Sofia Cerasuoli (@SwitchAxe)
+/*
+  This file is part of Rewind.
+  Rewind is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation, either version 3 of the license, or (at your
+  option) any later version.
+  Rewind is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Rewind. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "types.hpp"
+#include "memo.hpp"
+#include "procedures.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Lowers a parsed tree (see parse() in parser.hpp) into bytecode for the
+// register machine in vm.hpp. Every function literal is compiled once, when
+// it's parsed, and top-level forms are compiled right before running them.
+// Anything the compiler doesn't know how to lower is kept as a tree and
+// handed back to eval() at run time, so both paths always agree.
+
+enum class OpCode : std::uint8_t {
+  LoadConst,   // R[a] = K[b]
+  Move,        // R[a] = R[b]
+  LoadName,    // R[a] = call stack lookup of K[b], or K[b] itself
+  LoadVar,     // R[a] = $b, from the globals, then R[e] or the locals
+  LoadFolded,  // R[a] = K[b], the folded value of K[c], unless a function
+               // is now bound to one of the builtins listed in K[d]
+  MakeList,    // R[a] = '[R[b] ... R[b + c - 1]]
+  MakeMap,     // R[a] = '{R[b] ... R[b + c - 1]}
+  Call,        // R[a] = b(R[c] ... R[c + d - 1]), R[e] may hold b
+  TailCall,    // the same, but a user function replaces the running one
+  Let,         // bind b to R[c] (globally if d != 0, in R[e] if e >= 0)
+  CheckBool,   // throw unless R[a] is a boolean, b names the operator
+  Jump,        // pc = a
+  JumpIfFalse, // if R[a] is falsy, pc = b
+  JumpIfTrue,  // if R[a] is truthy, pc = b
+  Eval,        // R[a] = eval(K[b]), the tree-walking fallback (in tail
+               // position if d != 0, see eval_tail())
+  Return,      // return R[a]
+};
+
+struct Instr {
+  OpCode op;
+  int a = 0;
+  int b = 0;
+  int c = 0;
+  int d = 0;
+  int e = -1;
+};
+
+// what a Call instruction resolved its callee to, the last time it ran.
+// Only valid while 'version' is still the current binding_version.
+struct CallCache {
+  std::uint64_t version = 0;
+  const Symbol* function = nullptr; // a global function
+  const Builtin* builtin = nullptr;
+};
+
+struct Chunk {
+  std::vector<Instr> code;
+  mutable std::vector<CallCache> caches; // one per instruction
+  std::vector<int> lines; // source line of each instruction
+  std::vector<Symbol> pool; // constants, names and fallback trees
+  std::vector<SymbolId> params; // the parameters live in R[0]...R[n - 1]
+  // the names the body calls or reads that aren't its parameters or
+  // locals, the only ones the function itself could be bound to when it
+  // runs, see bind_self() in vm.hpp.
+  std::vector<SymbolId> captures;
+  bool needs_env = false; // the body binds or evaluates in its variables
+  // some of the constants are the values globals had when it was compiled
+  // (see constant_value()), so it's only good for the same globals
+  bool folds_globals = false;
+  int nregs = 0;
+  // set on the copy of the chunk a memoized function runs, see 'memo'
+  std::shared_ptr<MemoTable> memo;
+};
+
+// true if eval() would hand the symbol back unchanged, so builtin results
+// don't need another trip through the tree-walker.
+bool is_self_evaluating(const Symbol& s) {
+  switch (s.type) {
+  case Type::Number:
+  case Type::String:
+  case Type::Boolean:
+  case Type::Function:
+  case Type::Map:
+  case Type::Command:
+  case Type::CommandResult:
+  case Type::Error:
+  case Type::RawAst:
+    return true;
+  case Type::List:
+    return std::get<List>(s.value).all_of([](const Symbol& x) {
+      return (x.type == Type::Number) || (x.type == Type::String) ||
+             (x.type == Type::Boolean);
+    });
+  default:
+    return false;
+  }
+}
+
+struct Compiler {
+  Chunk chunk;
+  int next = 0; // first free register
+  bool in_function = false;
+  bool global = false; // top-level 'let's bind into the globals
+  // give the 'let's at the top of a function body a register each, see
+  // local_let(). Turned off if the function needs its variables anyway.
+  bool slot_lets = false;
+  bool needs_env = false;
+  std::vector<std::pair<SymbolId, int>> locals; // let-bound name, register
+
+  int emit(Instr in, int line) {
+    chunk.code.push_back(in);
+    chunk.lines.push_back(line);
+    return chunk.code.size() - 1;
+  }
+
+  int constant(const Symbol& s) {
+    chunk.pool.push_back(s);
+    return chunk.pool.size() - 1;
+  }
+
+  int alloc() {
+    next++;
+    chunk.nregs = std::max(chunk.nregs, next);
+    return next - 1;
+  }
+
+  int param_slot(SymbolId id) {
+    auto it = std::find(chunk.params.begin(), chunk.params.end(), id);
+    if (it == chunk.params.end())
+      return -1;
+    return it - chunk.params.begin();
+  }
+
+  int local_slot(SymbolId id) {
+    for (auto& [name, r] : locals)
+      if (name == id)
+        return r;
+    return -1;
+  }
+
+  void capture(SymbolId id) {
+    if ((param_slot(id) < 0) && (local_slot(id) < 0) &&
+        (std::find(chunk.captures.begin(), chunk.captures.end(), id) ==
+         chunk.captures.end()))
+      chunk.captures.push_back(id);
+  }
+
+  void patch(int at, int target) {
+    if (chunk.code[at].op == OpCode::Jump)
+      chunk.code[at].a = target;
+    else
+      chunk.code[at].b = target;
+  }
+
+  int here() { return chunk.code.size(); }
+
+  void fallback(const Symbol& node, int dst, int line, bool tail = false) {
+    needs_env = true;
+    emit({.op = OpCode::Eval, .a = dst, .b = constant(node), .d = tail},
+         line);
+  }
+
+  // 'tail' is set for the expression whose value the function returns.
+  void expr(const Symbol& node, int dst, int line, bool tail = false) {
+    if ((node.type == Type::Identifier) || (node.type == Type::ListLiteral) ||
+        (node.type == Type::MapLiteral) || (node.type == Type::List)) {
+      List guards;
+      if (auto value = constant_value(node, guards)) {
+        if (guards.empty())
+          emit({.op = OpCode::LoadConst, .a = dst, .b = constant(*value)},
+               line);
+        else
+          emit({.op = OpCode::LoadFolded,
+                .a = dst,
+                .b = constant(*value),
+                .c = constant(node),
+                .d = constant(Symbol(guards, Type::List))},
+               line);
+        return;
+      }
+    }
+    switch (node.type) {
+    case Type::Identifier:
+    case Type::Operator: {
+      auto name = std::get<std::string>(node.value);
+      if ((node.type == Type::Identifier) && (name.size() > 1) &&
+          (name[0] == '$')) {
+        SymbolId var = intern(name.substr(1));
+        capture(var);
+        emit({.op = OpCode::LoadVar,
+              .a = dst,
+              .b = static_cast<int>(var),
+              .e = local_slot(var)},
+             line);
+      } else if (int slot = param_slot(node.id); slot >= 0) {
+        emit({.op = OpCode::Move, .a = dst, .b = slot}, line);
+      } else if (in_function) {
+        // the only names on a function's call stack frame are its
+        // parameters, so anything else is a bareword.
+        emit({.op = OpCode::LoadConst, .a = dst, .b = constant(node)}, line);
+      } else {
+        emit({.op = OpCode::LoadName, .a = dst, .b = constant(node)}, line);
+      }
+      return;
+    }
+    case Type::ListLiteral:
+    case Type::MapLiteral: {
+      auto l = std::get<List>(node.value);
+      int base = next;
+      for (auto& x : l)
+        expr(x, alloc(), x.line);
+      emit({.op = (node.type == Type::MapLiteral) ? OpCode::MakeMap
+                                                  : OpCode::MakeList,
+            .a = dst,
+            .b = base,
+            .c = static_cast<int>(l.size())},
+           line);
+      next = base;
+      return;
+    }
+    case Type::List:
+      list(node, dst, line, tail);
+      return;
+    default:
+      emit({.op = OpCode::LoadConst, .a = dst, .b = constant(node)}, line);
+      return;
+    }
+  }
+
+  // the value of 'node', if it's known at compile time: literals, list
+  // literals of constants, bound globals (which are never rebound), and
+  // calls of pure builtins on constants. The names of those builtins are
+  // added to 'guards'.
+  std::optional<Symbol> constant_value(const Symbol& node, List& guards) {
+    switch (node.type) {
+    case Type::Number:
+    case Type::String:
+    case Type::Boolean:
+      return node;
+    case Type::Identifier: {
+      if (!std::holds_alternative<std::string>(node.value))
+        return std::nullopt;
+      auto& name = std::get<std::string>(node.value);
+      if ((name.size() < 2) || (name[0] != '$'))
+        return std::nullopt;
+      Symbol* x =
+          interp().constants.find(std::string_view{name}.substr(1));
+      if ((x == nullptr) || (x->type == Type::Function) ||
+          !is_self_evaluating(*x))
+        return std::nullopt;
+      chunk.folds_globals = true;
+      return *x;
+    }
+    case Type::ListLiteral: {
+      List values;
+      for (auto& x : std::get<List>(node.value)) {
+        auto v = constant_value(x, guards);
+        if (v == std::nullopt)
+          return std::nullopt;
+        values.push_back(*v);
+      }
+      return Symbol(values, Type::ListLiteral);
+    }
+    case Type::MapLiteral: {
+      List values;
+      for (auto& x : std::get<List>(node.value)) {
+        auto v = constant_value(x, guards);
+        if (v == std::nullopt)
+          return std::nullopt;
+        values.push_back(*v);
+      }
+      return make_map(values.begin(), values.end());
+    }
+    case Type::List:
+      return fold_call(node, guards);
+    default:
+      return std::nullopt;
+    }
+  }
+
+  std::optional<Symbol> fold_call(const Symbol& node, List& guards) {
+    auto& l = std::get<List>(node.value);
+    // a call without arguments is never folded: not every pure builtin
+    // checks for them, and a body that is never called must not crash.
+    if (node.is_block || (l.size() < 2) ||
+        (l.front().type != Type::Operator))
+      return std::nullopt;
+    SymbolId name = l.front().id;
+    const Builtin* proc = procedure(name);
+    if (is_special_form(name) || (proc == nullptr) || !is_pure(*proc) ||
+        (param_slot(name) >= 0) || (local_slot(name) >= 0))
+      return std::nullopt;
+    if (Symbol* x = interp().constants.find(name);
+        x && (x->type == Type::Function))
+      return std::nullopt;
+    if ((proc->arity != Builtin::variadic) &&
+        (std::size_t(proc->arity) != l.size() - 1))
+      return std::nullopt; // let it throw at run time, with its line
+    List args;
+    for (std::size_t i = 1; i < l.size(); ++i) {
+      auto v = constant_value(l[i], guards);
+      if (v == std::nullopt)
+        return std::nullopt;
+      args.push_back(*v);
+    }
+    Symbol result;
+    try {
+      variables none;
+      result = (*proc)(args, path{}, none);
+    } catch (...) {
+      return std::nullopt; // same as above
+    }
+    if (!is_self_evaluating(result))
+      return std::nullopt;
+    capture(name);
+    guards.push_back(l.front());
+    return result;
+  }
+
+  void list(const Symbol& node, int dst, int line, bool tail) {
+    auto l = std::get<List>(node.value);
+    if (l.empty()) {
+      emit({.op = OpCode::LoadConst, .a = dst, .b = constant(node)}, line);
+      return;
+    }
+    if (node.is_block) {
+      for (std::size_t i = 0; i < l.size(); ++i)
+        expr(l[i], dst, l[i].line, tail && (i == l.size() - 1));
+      return;
+    }
+    auto head = l.front();
+    if (head.type != Type::Operator) {
+      // data and external program calls.
+      fallback(node, dst, line);
+      return;
+    }
+    auto name = std::get<std::string>(head.value);
+    l.pop_front();
+    if (name == "cond")
+      cond(node, l, dst, line, tail);
+    else if (name == "let")
+      let(node, l, dst, line);
+    else if ((name == "and") || (name == "or"))
+      logic(head.id, l, dst, line);
+    else if (is_special_form(head.id))
+      fallback(node, dst, line, tail);
+    else
+      call(head.id, l, dst, line, tail);
+  }
+
+  void call(SymbolId callee, const List& args, int dst, int line,
+            bool tail) {
+    int base = next;
+    capture(callee);
+    for (auto& x : args)
+      expr(x, alloc(), line);
+    emit({.op = tail ? OpCode::TailCall : OpCode::Call,
+          .a = dst,
+          .b = static_cast<int>(callee),
+          .c = base,
+          .d = static_cast<int>(args.size()),
+          .e = std::max(param_slot(callee), local_slot(callee))},
+         line);
+    next = base;
+  }
+
+  void cond(const Symbol& node, const List& branches, int dst,
+            int line, bool tail) {
+    for (auto& b : branches) {
+      if ((b.type != Type::List) ||
+          (std::get<List>(b.value).size() < 2)) {
+        // let 'cond' itself report the error
+        fallback(node, dst, line, tail);
+        return;
+      }
+    }
+    std::vector<int> exits;
+    for (auto& b : branches) {
+      auto l = std::get<List>(b.value);
+      auto clause = l.front();
+      l.pop_front();
+      int r = alloc();
+      expr(clause, r, clause.line);
+      int skip = emit({.op = OpCode::JumpIfFalse, .a = r}, clause.line);
+      next--;
+      for (std::size_t i = 0; i < l.size(); ++i)
+        expr(l[i], dst, l[i].line, tail && (i == l.size() - 1));
+      exits.push_back(emit({.op = OpCode::Jump}, line));
+      patch(skip, here());
+    }
+    emit({.op = OpCode::LoadConst,
+          .a = dst,
+          .b = constant(Symbol(false, Type::Boolean))},
+         line);
+    for (auto at : exits)
+      patch(at, here());
+  }
+
+  void let(const Symbol& node, const List& args, int dst,
+           int line) {
+    if ((args.size() != 2) || (args.front().type != Type::Identifier)) {
+      fallback(node, dst, line);
+      return;
+    }
+    needs_env = needs_env || in_function;
+    int r = alloc();
+    expr(args.back(), r, line);
+    emit({.op = OpCode::Let,
+          .a = dst,
+          .b = static_cast<int>(args.front().id),
+          .c = r,
+          .d = global},
+         line);
+    next--;
+  }
+
+  void logic(SymbolId op, const List& args, int dst, int line) {
+    // 'and' stops at the first false operand, 'or' at the first true one.
+    bool is_and = symbol_name(op) == "and";
+    std::vector<int> shortcuts;
+    int r = alloc();
+    for (auto& x : args) {
+      expr(x, r, line);
+      emit({.op = OpCode::CheckBool, .a = r, .b = static_cast<int>(op)},
+           line);
+      shortcuts.push_back(emit(
+          {.op = is_and ? OpCode::JumpIfFalse : OpCode::JumpIfTrue, .a = r},
+          line));
+    }
+    next--;
+    emit({.op = OpCode::LoadConst,
+          .a = dst,
+          .b = constant(Symbol(is_and, Type::Boolean))},
+         line);
+    int done = emit({.op = OpCode::Jump}, line);
+    for (auto at : shortcuts)
+      patch(at, here());
+    emit({.op = OpCode::LoadConst,
+          .a = dst,
+          .b = constant(Symbol(!is_and, Type::Boolean))},
+         line);
+    patch(done, here());
+  }
+
+  void body(const List& stmts, int line) {
+    int r = alloc();
+    if (stmts.empty())
+      emit({.op = OpCode::LoadConst,
+            .a = r,
+            .b = constant(Symbol(false, Type::Boolean))},
+           line);
+    for (std::size_t i = 0; i < stmts.size(); ++i)
+      if (!local_let(stmts[i], r))
+        expr(stmts[i], r, stmts[i].line,
+             in_function && (i == stmts.size() - 1));
+    emit({.op = OpCode::Return, .a = r}, line);
+  }
+
+  // a 'let' in the body of a function, but not inside any other form,
+  // always runs before the statements after it. Those can then read the
+  // variable straight from its register.
+  bool local_let(const Symbol& stmt, int dst) {
+    if (!slot_lets || (stmt.type != Type::List))
+      return false;
+    auto& l = std::get<List>(stmt.value);
+    if ((l.size() != 3) || (l[0].type != Type::Operator) ||
+        (symbol_name(l[0].id) != "let") || (l[1].type != Type::Identifier) ||
+        (local_slot(l[1].id) >= 0))
+      return false;
+    int slot = alloc();
+    int r = alloc();
+    expr(l[2], r, stmt.line);
+    emit({.op = OpCode::Let,
+          .a = dst,
+          .b = static_cast<int>(l[1].id),
+          .c = r,
+          .e = slot},
+         stmt.line);
+    next--;
+    locals.push_back({l[1].id, slot});
+    return true;
+  }
+};
+
+// returns nullptr if the function can't be compiled, in which case
+// eval_function() runs it on the tree-walker.
+std::shared_ptr<const Chunk> compile_function(const Symbol& fn) {
+  if (!std::holds_alternative<List>(fn.value))
+    return nullptr;
+  auto parts = std::get<List>(fn.value);
+  if ((parts.size() != 2) || (parts.front().type != Type::List) ||
+      (parts.back().type != Type::List))
+    return nullptr;
+  for (auto& p : std::get<List>(parts.front().value))
+    if (p.id == no_symbol)
+      return nullptr;
+  for (bool slot_lets : {true, false}) {
+    Compiler c;
+    c.in_function = true;
+    c.slot_lets = slot_lets;
+    for (auto& p : std::get<List>(parts.front().value))
+      c.chunk.params.push_back(p.id);
+    c.next = c.chunk.nregs = c.chunk.params.size();
+    c.body(std::get<List>(parts.back().value), fn.line);
+    if (!slot_lets || !c.needs_env || c.locals.empty()) {
+      c.chunk.needs_env = c.needs_env;
+      c.chunk.caches.resize(c.chunk.code.size());
+      return std::make_shared<const Chunk>(std::move(c.chunk));
+    }
+  }
+  return nullptr;
+}
+
+std::shared_ptr<const Chunk> compile_toplevel(const Symbol& form) {
+  Compiler c;
+  c.global = form.is_global;
+  c.body(List{form}, form.line);
+  c.chunk.caches.resize(c.chunk.code.size());
+  return std::make_shared<const Chunk>(std::move(c.chunk));
+}
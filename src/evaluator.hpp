@@ -14,6 +14,7 @@
   You should have received a copy of the GNU General Public License along with
   Rewind. If not, see <https://www.gnu.org/licenses/>.
 */
+#include "compiler.hpp"
 #include "parser.hpp"
 #include "procedures.hpp"
 #include "src/external.hpp"
@@ -28,54 +29,120 @@
 #include <sys/wait.h>
 #include <unistd.h>
 #include <variant>
-Symbol eval(Symbol root, const path &PATH, variables& vars, int line);
+Symbol eval(Symbol root, const path &PATH, variables& vars, int line,
+            bool tail);
 Symbol eval_primitive_node(Symbol node, const path &PATH,
-                           variables& vars = constants, int line = 0);
-std::pair<bool, Symbol>
-check_for_tail_recursion(std::string name, Symbol funcall, const path &PATH, variables vs) {
-  if (funcall.type != Type::List)
-    return {false, funcall};
-  auto lst = std::get<std::list<Symbol>>(funcall.value);
-  if (lst.empty())
-    return {false, funcall};
-  auto fstnode = lst.front();
-  if ((fstnode.type != Type::Identifier) && (fstnode.type != Type::Operator)) {
-    return {false, funcall};
-  }
-  auto nodename = std::get<std::string>(fstnode.value);
-  if ((nodename == "if") || (nodename == "cond")) {
-    lst.pop_front();
-    auto branch = procedures[nodename](lst, PATH, vs);
-    return check_for_tail_recursion(name, branch, PATH, vs);
+                           variables& vars = interp().constants, int line = 0,
+                           bool tail = false);
+
+// the RecFunCall handed back for a call in tail position: the callee,
+// followed by the call itself with its arguments already evaluated.
+Symbol tail_call(Symbol node, const Symbol& func) {
+  std::get<List>(node.value).push_front(func);
+  node.type = Type::RecFunCall;
+  return node;
+}
+
+// evaluates the last statement of a function body. A call to a user
+// function in tail position isn't made here, but returned as a RecFunCall
+// for the trampoline in eval() (or the VM) to run in place of the caller.
+// 'cond', 'match' and blocks pass the tail position on to the branch they
+// pick, so their conditions are evaluated only once.
+Symbol eval_tail(Symbol expr, const path& PATH, variables& vars, int line) {
+  if (expr.type != Type::List)
+    return eval(expr, PATH, vars, line);
+  auto l = std::get<List>(expr.value);
+  if (l.empty())
+    return expr;
+  if (expr.is_block) {
+    auto last = l.back();
+    l.pop_back();
+    for (auto& e : l)
+      eval(e, PATH, vars, e.line);
+    return eval_tail(last, PATH, vars, last.line);
   }
-  if (nodename == name) {
-    return {true, funcall};
+  auto head = l.front();
+  if (head.type != Type::Operator)
+    return eval(expr, PATH, vars, line, true);
+  l.pop_front();
+  auto name = std::get<std::string>(head.value);
+  List body;
+  variables scope{&vars};
+  if (name == "cond") {
+    for (auto& b : l) {
+      if ((b.type != Type::List) || (std::get<List>(b.value).size() < 2))
+        return eval(expr, PATH, vars, line); // let 'cond' report it
+    }
+    auto branch = std::find_if(l.begin(), l.end(), [&](const Symbol& b) {
+      auto& clause = std::get<List>(b.value).front();
+      return convert_value_to_bool(eval(clause, PATH, vars, clause.line));
+    });
+    if (branch == l.end())
+      return Symbol(false, Type::Boolean);
+    body = std::get<List>(branch->value);
+    body.pop_front();
+  } else if ((name == "match") && !l.empty()) {
+    try {
+      Symbol matched = eval(l.front(), PATH, vars, line);
+      l.pop_front();
+      auto arm = select_match_arm(matched, l, scope, PATH);
+      if (arm == std::nullopt)
+        return Symbol(false, Type::Boolean);
+      body = *arm;
+    } catch (std::logic_error ex) {
+      throw std::logic_error{"Rewind (line " + std::to_string(line) +
+                             "): " + ex.what()};
+    }
+    if (body.empty())
+      return Symbol();
+  } else {
+    return eval(expr, PATH, vars, line, true);
   }
-  return {false, funcall};
+  // the captures of a 'match' arm are local to it
+  variables& vs = (name == "match") ? scope : vars;
+  auto last = body.back();
+  body.pop_back();
+  for (auto& e : body)
+    eval(e, PATH, vs, e.line);
+  return eval_tail(last, PATH, vs, last.line);
 }
 
 Symbol eval_function(Symbol node, const path& PATH, int line,
 		                 std::optional<Symbol> f = std::nullopt) {
-  auto as_list = std::get<std::list<Symbol>>(node.value);
+  Interpreter& rt = interp();
+  auto as_list = std::get<List>(node.value);
+  if (node.type == Type::RecFunCall) {
+    // see tail_call()
+    f = as_list.front();
+    as_list.pop_front();
+    node.value = as_list;
+  }
   std::string op = std::get<std::string>(as_list.front().value);
-  variables vars = constants;
+  SymbolId op_id = as_list.front().id;
   Symbol func;
   if (f == std::nullopt) {
-    if (constants.contains(op))
-      if (constants[op].type == Type::Function)
-	      func = constants[op];
+    if (rt.constants.contains(op_id))
+      if (rt.constants[op_id].type == Type::Function)
+	      func = rt.constants[op_id];
     else if (auto x = callstack_variable_lookup(as_list.front()); x != std::nullopt)
       if (x->type == Type::Function)
 	      func = *x;
     else throw std::logic_error {"Unbound function " + op + "!\n"};
   }
   if (f != std::nullopt) func = *f;
-  vars.insert({op, func}); // to enable the use of recursive local functions
-  auto func_as_l = std::get<std::list<Symbol>>(func.value);
+  if (!rt.reference_mode && func.code) {
+    if ((node.type == Type::RecFunCall) && !rt.call_stack.empty())
+      rt.call_stack.pop_back(); // the frame of the caller we replace
+    as_list.pop_front();
+    return vm_call(op_id, func, as_list, PATH);
+  }
+  variables vars{&rt.constants};
+  vars.insert({op_id, func}); // to enable the use of recursive local functions
+  auto func_as_l = std::get<List>(func.value);
   // get the various parts of the function
-  auto parameters = std::get<std::list<Symbol>>(func_as_l.front().value);
+  auto parameters = std::get<List>(func_as_l.front().value);
   func_as_l.pop_front();
-  auto body = std::get<std::list<Symbol>>(func_as_l.front().value);
+  auto body = std::get<List>(func_as_l.front().value);
   func_as_l.pop_front();
   as_list.pop_front();
 
@@ -87,46 +154,75 @@ Symbol eval_function(Symbol node, const path& PATH, int line,
 			    ") for call to " + rec_print_ast(func) +
 			    " don't match!\n" + "the call was: " +
 			    rec_print_ast(node) + "\n"};
-  std::map<std::string, Symbol> frame = {};
-  while (parameters.size() > 0) {
-    auto p = std::get<std::string>(parameters.front().value);
-    frame.insert(std::make_pair(p, as_list.front()));
-    parameters.pop_front();
-    as_list.pop_front();
+  // a memoized function that already ran with these arguments isn't
+  // called again, and doesn't even get a frame
+  auto memo = func.code ? func.code->memo : nullptr;
+  if (memo)
+    if (auto hit = memo->find(as_list)) {
+      if ((node.type == Type::RecFunCall) && !rt.call_stack.empty())
+        rt.call_stack.pop_back();
+      return *hit;
+    }
+  Frame frame{.function = op_id, .args{as_list.begin(), as_list.end()}};
+  if (func.code) {
+    frame.params = {func.code, &func.code->params};
+  } else {
+    auto ids = std::make_shared<std::vector<SymbolId>>();
+    for (auto& p : parameters)
+      ids->push_back(p.id);
+    frame.params = ids;
   }
   if (node.type != Type::RecFunCall)
-    call_stack.push_back(std::make_pair(op, frame));
+    rt.call_stack.push_back(std::move(frame));
   else {
-    if (!call_stack.empty())
-      call_stack.pop_back();
-    call_stack.push_back(std::make_pair(op, frame));
+    if (!rt.call_stack.empty())
+      rt.call_stack.pop_back();
+    rt.call_stack.push_back(std::move(frame));
   }
-  auto last = body.back();
-  body.pop_back();
-  Symbol result;
-  for (auto e : body) {
-    result = eval(e, PATH, vars, line);
+  Symbol result = Symbol(false, Type::Boolean);
+  if (!body.empty()) {
+    auto last = body.back();
+    body.pop_back();
+    for (auto e : body) {
+      result = eval(e, PATH, vars, line);
+    }
+    result = eval_tail(last, PATH, vars, line);
+    if ((result.type == Type::RecFunCall) && memo) {
+      // the result to remember is the one of the tail call, and the
+      // callee's frame replaces ours
+      while (result.type == Type::RecFunCall)
+        result = eval_function(result, PATH, line);
+      memo->insert(as_list, result);
+      return result;
+    }
+    if (result.type == Type::RecFunCall)
+      return result; // our frame is replaced by the callee's
   }
+  rt.call_stack.pop_back();
+  if (memo)
+    memo->insert(as_list, result);
+  return result;
+}
 
-  if (auto last_call = check_for_tail_recursion(op, last, PATH, vars);
-      last_call.first == false) {
-    result = eval(last_call.second, PATH, vars, line);
-  } else {
-    last = last_call.second;
-    last.type = Type::RecFunCall;
-    return last;
-  }
-  call_stack.pop_back();
+// calls a function value with arguments that are already evaluated, for
+// the builtins taking a function. Inside its body, it has no name to call
+// itself by.
+Symbol apply_function(const Symbol& func, List args, const path& PATH) {
+  static const SymbolId anonymous = intern("(anonymous)");
+  args.push_front(Symbol(symbol_name(anonymous), Type::Operator));
+  Symbol result = eval_function(Symbol(args, Type::List), PATH, 0, func);
+  while (result.type == Type::RecFunCall)
+    result = eval_function(result, PATH, 0);
   return result;
 }
 
 // to use with nodes with only leaf children.
 Symbol eval_primitive_node(Symbol node, const path &PATH,
-                           variables& vars, int line) {
+                           variables& vars, int line, bool tail) {
   Symbol result;
   std::optional<std::string> absolute; // absolute path of an executable, if any
   auto it = PATH.begin();
-  auto l = std::get<std::list<Symbol>>(node.value);
+  auto l = std::get<List>(node.value);
   if (l.empty())
     return node;
   Symbol op = l.front();
@@ -139,28 +235,29 @@ Symbol eval_primitive_node(Symbol node, const path &PATH,
     return node;
   }
   if (op.type == Type::Operator) {
-    if (auto s = std::get<std::string>(op.value); constants.contains(s)) {
-      if (auto x = constants[s]; x.type == Type::Function)
-        return eval_function(node, PATH, line, x);
-    } else if (vars.contains(s)) {
-      if (auto x = vars[s]; x.type == Type::Function)
-	return eval_function(node, PATH, line, x);
+    if (Symbol* x = interp().constants.find(op.id)) {
+      if (x->type == Type::Function)
+        return tail ? tail_call(node, *x) : eval_function(node, PATH, line, *x);
+    } else if (Symbol* x = vars.find(op.id)) {
+      if (x->type == Type::Function)
+	return tail ? tail_call(node, *x) : eval_function(node, PATH, line, *x);
     }
   }
 
   if (auto x = callstack_variable_lookup(op); x != std::nullopt)
     if (x->type == Type::Function)
-      return eval_function(node, PATH, line, *x);
+      return tail ? tail_call(node, *x) : eval_function(node, PATH, line, *x);
   if (op.type == Type::Operator) {
     l.pop_front();
     node.value = l;
     auto s = std::get<std::string>(op.value);
-    if (procedures.contains(s)) {
-      Functor fun = procedures[s];
+    if (const Builtin* proc = procedure(op.id)) {
+      const Builtin& fun = *proc;
       if ((s == "->") || (s == "let")) {
-        l.push_front(Symbol("", node.is_global, Type::Boolean));
+        l.push_front(Symbol(node.is_global, Type::Boolean));
       }
       try {
+        check_arity(fun, l.size());
         result = fun(l, PATH, vars);
       } catch (std::logic_error ex) {
         throw std::logic_error{"Rewind (line " + std::to_string(line) +
@@ -178,7 +275,8 @@ Symbol eval_primitive_node(Symbol node, const path &PATH,
   return node;
 }
 
-Symbol eval(Symbol root, const path &PATH, variables& vars, int line) {
+Symbol eval(Symbol root, const path &PATH, variables& vars, int line,
+            bool tail) {
   Symbol result;
   std::stack<Symbol> node_stk;
   Symbol current_node;
@@ -186,7 +284,7 @@ Symbol eval(Symbol root, const path &PATH, variables& vars, int line) {
   // this is the data on which the actual computation takes place,
   // as we copy every intermediate result we get into this as a "leaf"
   // to compute the value for each node, including the root.
-  std::vector<std::list<Symbol>> leaves;
+  std::vector<List> leaves;
   current_node = root;
   switch (root.type) {
   case Type::Number:
@@ -196,37 +294,48 @@ Symbol eval(Symbol root, const path &PATH, variables& vars, int line) {
   case Type::RawAst:
     return root;
   case Type::ListLiteral: {
-    auto l = std::get<std::list<Symbol>>(root.value);
+    auto l = std::get<List>(root.value);
     for (auto& x: l) x = eval(x, PATH, vars, x.line);
     root.value = l;
     return root;
   }
+  case Type::MapLiteral: {
+    auto l = std::get<List>(root.value);
+    for (auto& x: l) x = eval(x, PATH, vars, x.line);
+    Symbol m = make_map(l.begin(), l.end());
+    m.line = root.line;
+    return m;
+  }
+  case Type::Map:
+    return root;
   default: break;
   }
   if (root.type == Type::List)
-    if (std::get<std::list<Symbol>>(root.value).empty())
+    if (std::get<List>(root.value).empty())
       return root;
   do {
     // for each node, visit each child and backtrack to the last parent node
     // when the last child is null, and continue with the second last node and
     // so on
     if (current_node.type == Type::List) {
-      if (std::get<std::list<Symbol>>(current_node.value).empty()) {
+      if (std::get<List>(current_node.value).empty()) {
         // if we're back to the root node, and we don't have any
         // children left, we're done.
         if (leaves.empty())
           break;
         Symbol eval_temp_arg;
         eval_temp_arg =
-          Symbol(current_node.name, leaves[leaves.size() - 1], Type::List);
+          Symbol(leaves[leaves.size() - 1], Type::List);
         
         if (root.is_global)
           eval_temp_arg.is_global = true;
-        result = eval_primitive_node(eval_temp_arg, PATH, vars, line);
+        // only the call at the root is in tail position
+        bool is_tail = tail && (leaves.size() == 1);
+        result = eval_primitive_node(eval_temp_arg, PATH, vars, line, is_tail);
         leaves.pop_back();
 
         // main trampoline
-        if (result.type == Type::RecFunCall) {
+        if ((result.type == Type::RecFunCall) && !is_tail) {
           while (result.type == Type::RecFunCall) {
             result = eval_function(result, PATH, line);
           }
@@ -241,12 +350,11 @@ Symbol eval(Symbol root, const path &PATH, variables& vars, int line) {
         } else
           return result;
       } else {
-        Symbol child = std::get<std::list<Symbol>>(current_node.value).front();
-        auto templ = std::get<std::list<Symbol>>(current_node.value);
+        auto& templ = std::get<List>(current_node.value);
+        Symbol child = templ.front();
         templ.pop_front();
-        current_node.value = templ;
         if (child.type == Type::List) {
-          auto l = std::get<std::list<Symbol>>(child.value);
+          const auto& l = std::get<List>(child.value);
           if (l.empty()) {
             if (leaves.empty())
               leaves.push_back({});
@@ -272,22 +380,21 @@ Symbol eval(Symbol root, const path &PATH, variables& vars, int line) {
           Symbol dummy;
           if (!node_stk.empty())
             dummy =
-                Symbol(node_stk.top().name, std::list<Symbol>(), Type::List);
+                Symbol(List(), Type::List);
           else
-            dummy = Symbol("", std::list<Symbol>(), Type::List);
+            dummy = Symbol(List(), Type::List);
           current_node = dummy;
           node_stk.push(current_node);
         } else {
           node_stk.push(current_node);
           current_node = child;
-          std::list<Symbol> l;
-          if (child.type == Type::List)
-            l = std::get<std::list<Symbol>>(child.value);
-          if (leaves.empty() || ((child.type == Type::List) && !l.empty()))
-            leaves.push_back(std::list<Symbol>{});
-          else if ((child.type == Type::List) && l.empty()) {
+          bool is_empty_list = (child.type == Type::List) &&
+                               std::get<List>(child.value).empty();
+          if (leaves.empty() || ((child.type == Type::List) && !is_empty_list))
+            leaves.push_back(List{});
+          else if (is_empty_list) {
             if (leaves.empty()) {
-              leaves.push_back(l);
+              leaves.push_back(List{});
             } else {
               leaves[leaves.size() - 1].push_back(child);
             }
@@ -300,12 +407,14 @@ Symbol eval(Symbol root, const path &PATH, variables& vars, int line) {
       if (current_node.type == Type::RawAst) {
         return current_node;
       }
+      if (current_node.type == Type::MapLiteral)
+        current_node = eval(current_node, PATH, vars, current_node.line);
       if ((current_node.type == Type::Boolean) ||
           (current_node.type == Type::Number) ||
           (current_node.type == Type::String)) {
 
         if (leaves.empty())
-          leaves.push_back(std::list<Symbol>{});
+          leaves.push_back(List{});
         leaves[leaves.size() - 1].push_back(current_node);
 
         if (node_stk.empty())
@@ -320,27 +429,25 @@ Symbol eval(Symbol root, const path &PATH, variables& vars, int line) {
         op = std::get<std::string>(current_node.value);
       }
       if ((current_node.type == Type::Operator) &&
-          (std::find(special_forms.begin(), special_forms.end(), op) !=
-           special_forms.end()) &&
-          (!node_stk.empty())) {
+          is_special_form(current_node.id) && (!node_stk.empty())) {
         // delay the evaluation of special forms
-        auto spfl = std::get<std::list<Symbol>>(node_stk.top().value);
+        auto spfl = std::get<List>(node_stk.top().value);
         if ((!leaves.empty()) && (!leaves.back().empty())) {
           leaves[leaves.size() - 1].push_back(current_node);
         } else {
           if (leaves.empty())
-            leaves.push_back(std::list<Symbol>());
+            leaves.push_back(List());
           leaves[leaves.size() - 1] = spfl;
           leaves[leaves.size() - 1].push_front(current_node);
           Symbol dummy =
-              Symbol(node_stk.top().name, std::list<Symbol>(), Type::List);
+              Symbol(List(), Type::List);
           node_stk.pop();
           node_stk.push(dummy);
         }
       } else if (auto p_opt = callstack_variable_lookup(current_node);
                  p_opt != std::nullopt) {
         if (leaves.empty())
-          leaves.push_back(std::list<Symbol>{});
+          leaves.push_back(List{});
 	if (p_opt->type != Type::Function) {
 	  leaves[leaves.size() - 1].push_back(*p_opt);
 	} else if (leaves.back().size() > 0) {
@@ -350,26 +457,26 @@ Symbol eval(Symbol root, const path &PATH, variables& vars, int line) {
 	}
       } else if (current_node.type == Type::Identifier) {
         if (op[0] == '$') {
-          if (constants.contains(op.substr(1))) {
-	          auto var = constants[op.substr(1)];
+          if (interp().constants.contains(op.substr(1))) {
+	          auto var = interp().constants[op.substr(1)];
             if (leaves.empty())
-              leaves.push_back(std::list<Symbol>{});
+              leaves.push_back(List{});
             leaves[leaves.size() - 1].push_back(var);
           } else if (vars.contains(op.substr(1))) {
             auto var = vars[op.substr(1)];
             if (leaves.empty())
-              leaves.push_back(std::list<Symbol>{});
+              leaves.push_back(List{});
             leaves[leaves.size() - 1].push_back(var);
           } else
             throw std::logic_error{"Unbound variable " + op.substr(1) + "!"};
         } else {
           if (leaves.empty())
-            leaves.push_back(std::list<Symbol>{});
+            leaves.push_back(List{});
           leaves[leaves.size() - 1].push_back(current_node);
         }
       } else {
         if (leaves.empty())
-          leaves.push_back(std::list<Symbol>{});
+          leaves.push_back(List{});
         leaves[leaves.size() - 1].push_back(current_node);
       }
       if (node_stk.empty())
@@ -28,8 +28,10 @@ std::string to_str(Symbol sym) {
   std::string arg = std::visit(overloaded{
     [](std::string s) { return is_strlit(s) ? s.substr(1, s.size() - 2) : s; },
     [](signed long long int x) { return std::to_string(x); },
-    [](unsigned long long int x) { return std::to_string(x); },
-    [](std::list<Symbol> l) -> std::string { return ""; },
+    [](const BigInt& x) { return x.to_string(); },
+    [](double x) { return format_double(x); },
+    [](List l) -> std::string { return ""; },
+    [](const Map&) -> std::string { return ""; },
     [](bool b) -> std::string { return b ? "true" : "false"; },
     [](std::monostate) -> std::string { return ""; }
   }, sym.value);
@@ -44,12 +46,12 @@ PidSym rewind_call_ext_program(Symbol node,
   const auto is_strlit = [](std::string s) -> bool {
     return (s.size() > 1) && (s[0] == '"') && (s[s.size() - 1] == '"');
   };
-  std::list<Symbol> nodel = std::get<std::list<Symbol>>(node.value);
+  List nodel = std::get<List>(node.value);
   int total_size = 1;
   for (auto &e : nodel) {
     e = eval(e, PATH);
     total_size += (e.type == Type::List)
-                      ? std::get<std::list<Symbol>>(e.value).size()
+                      ? std::get<List>(e.value).size()
                       : 1;
   }
   std::string prog = std::get<std::string>(nodel.front().value);
@@ -60,7 +62,7 @@ PidSym rewind_call_ext_program(Symbol node,
   int i = 1;
   for (auto cur : nodel) {
     if (cur.type == Type::List) {
-      for (auto e : std::get<std::list<Symbol>>(cur.value)) {
+      for (auto e : std::get<List>(cur.value)) {
         std::string arg = to_str(e);
         argv[i] = (char *)malloc(arg.length() + 1);
         std::strcpy(argv[i], arg.c_str());
@@ -77,7 +79,7 @@ PidSym rewind_call_ext_program(Symbol node,
   argv[i] = nullptr;
   int status = 0;
   int pid = fork();
-  active_pids.push_back(pid);
+  interp().active_pids.push_back(pid);
   if (pid == 0) {
     if (must_pipe) {
       if (pipe_fd_out != 1) {
@@ -96,6 +98,7 @@ PidSym rewind_call_ext_program(Symbol node,
       }
     }
     // check for additional environment variables
+    auto &environment_variables = interp().environment_variables;
     if (environment_variables.empty()) {
       status = execv(prog.c_str(), argv);
     } else {
@@ -114,7 +117,7 @@ PidSym rewind_call_ext_program(Symbol node,
       status = execve(prog.c_str(), argv, envp);
     }
     if (status) {
-      return {Symbol("", status, Type::Number), -1};
+      return {Symbol(status, Type::Number), -1};
     }
     exit(1);
   } else if (pid > 0) {
@@ -126,7 +129,7 @@ PidSym rewind_call_ext_program(Symbol node,
     for (int idx = 1; argv[idx] != nullptr; ++idx) {
       free(argv[idx]);
     }
-    return {Symbol("", status, Type::Command), pid};
+    return {Symbol(status, Type::Command), pid};
   } else {
     throw std::logic_error{"Error while executing child process " + prog +
                            "!\n"};
@@ -137,7 +140,7 @@ Symbol rewind_pipe(Symbol node, const std::vector<std::string> &PATH,
                    bool must_read) {
   int fd[2]; // fd[0] reads, fd[1] writes
   PidSym status;
-  std::list<Symbol> nodel = std::get<std::list<Symbol>>(node.value);
+  List nodel = std::get<List>(node.value);
   auto last = nodel.back();
   nodel.pop_back();
   if (pipe(fd) == -1)
@@ -164,7 +167,7 @@ Symbol rewind_pipe(Symbol node, const std::vector<std::string> &PATH,
     if (result.back() == '\n') {
       result.pop_back();
     }
-    return Symbol("", result, Type::String);
+    return Symbol(result, Type::String);
   }
   auto first = nodel.front();
   nodel.pop_front();
@@ -191,7 +194,7 @@ Symbol rewind_pipe(Symbol node, const std::vector<std::string> &PATH,
     char buf[1024];
     std::string result;
     if (std::get<long long int>(status.s.value) == -1) {
-      return Symbol("", "Null", Type::String);
+      return Symbol("Null", Type::String);
     }
     while ((cnt = read(fd[0], buf, 1023))) {
       if (cnt == -1)
@@ -207,7 +210,7 @@ Symbol rewind_pipe(Symbol node, const std::vector<std::string> &PATH,
     if (result.back() == '\n') {
       result.pop_back();
     }
-    return Symbol("", result, Type::String);
+    return Symbol(result, Type::String);
   } else {
     close(fd[1]);
     status = rewind_call_ext_program(last, PATH, true, 1, fd[0]);
@@ -0,0 +1,210 @@
+#pragma once
+// Copyright 2023 Sofia Cerasuoli (@SwitchAxe)
+/*
+  This file is part of Rewind.
+  Rewind is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation, either version 3 of the license, or (at your
+  option) any later version.
+  Rewind is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Rewind. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+// The heap of the list values (see Seq in types.hpp). Their buffers are
+// reference counted, so a buffer goes back to the heap as soon as the last
+// list using it is dropped, and the heap only has to make allocating and
+// freeing them cheap: blocks of each size class are bumped out of big
+// chunks, and freed blocks are kept on a free list to be handed out again.
+// Every thread has a heap of its own, and a chunk knows the heap it belongs
+// to: a block freed by another thread (say, a list made by a worker of the
+// parallel builtins, dropped by the main thread) goes back to its own heap
+// through a lock-free list, taken back once the free list runs dry. The
+// heap of a thread that exits lives on until the last of its blocks is
+// freed, and then returns its chunks to the system.
+
+struct HeapStats {
+  std::size_t allocated = 0; // blocks handed out, in total
+  std::size_t freed = 0; // by this thread
+  std::size_t returned = 0; // freed by other threads, and taken back
+  std::size_t reused = 0; // blocks that came from a free list
+  std::size_t chunks = 0;
+  std::size_t large = 0; // allocations too big for a size class
+};
+
+class Heap {
+public:
+  static constexpr std::size_t min_block = 16;
+  static constexpr std::size_t max_block = 4096;
+  static constexpr std::size_t chunk_size = 64 * 1024;
+
+  Heap() = default;
+  Heap(const Heap&) = delete;
+  Heap& operator=(const Heap&) = delete;
+  ~Heap() {
+    for (void* c : chunks)
+      ::operator delete(c, std::align_val_t{chunk_size});
+  }
+
+  void* allocate(std::size_t bytes) {
+    if (bytes > max_block) {
+      stats.large++;
+      return ::operator new(bytes);
+    }
+    stats.allocated++;
+    live++;
+    std::size_t k = size_class(bytes);
+    auto& c = classes[k];
+    if ((c.free == nullptr) &&
+        (remote[k].load(std::memory_order_relaxed) != nullptr))
+      take_back(k);
+    if (c.free != nullptr) {
+      stats.reused++;
+      FreeBlock* b = c.free;
+      c.free = b->next;
+      return b;
+    }
+    std::size_t size = block_size(bytes);
+    if (c.bump + size > c.end) {
+      void* chunk = ::operator new(chunk_size, std::align_val_t{chunk_size});
+      new (chunk) Chunk{this};
+      chunks.push_back(chunk);
+      c.bump = static_cast<std::byte*>(chunk) + chunk_header;
+      c.end = static_cast<std::byte*>(chunk) + chunk_size;
+      stats.chunks++;
+    }
+    void* p = c.bump;
+    c.bump += size;
+    return p;
+  }
+
+  // a block of any heap, from any thread
+  static void deallocate(void* p, std::size_t bytes) {
+    if (bytes > max_block) {
+      ::operator delete(p);
+      return;
+    }
+    Heap* owner = chunk_of(p)->owner;
+    std::size_t k = size_class(bytes);
+    if (owner == current) {
+      owner->stats.freed++;
+      owner->live--;
+      auto& c = owner->classes[k];
+      c.free = new (p) FreeBlock{c.free};
+      return;
+    }
+    auto& head = owner->remote[k];
+    auto b = new (p) FreeBlock{head.load(std::memory_order_relaxed)};
+    while (!head.compare_exchange_weak(b->next, b, std::memory_order_release,
+                                       std::memory_order_relaxed)) {
+    }
+    if (owner->owed.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      delete owner; // the last block of a thread that's gone
+  }
+
+  HeapStats stats;
+
+private:
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+  struct SizeClass {
+    FreeBlock* free = nullptr;
+    std::byte* bump = nullptr; // the unused part of the last chunk
+    std::byte* end = nullptr;
+  };
+  // at the start of every chunk, which is aligned on its size
+  struct Chunk {
+    Heap* owner;
+  };
+  static constexpr std::size_t chunk_header = alignof(std::max_align_t);
+  static_assert(sizeof(Chunk) <= chunk_header);
+  static constexpr std::size_t num_classes =
+      std::countr_zero(max_block) - std::countr_zero(min_block) + 1;
+  // 'owed' counts down from this while the thread is alive
+  static constexpr std::size_t alive = std::size_t{1} << 62;
+
+  static std::size_t block_size(std::size_t bytes) {
+    return std::bit_ceil(std::max(bytes, min_block));
+  }
+  static std::size_t size_class(std::size_t bytes) {
+    return std::countr_zero(block_size(bytes)) -
+           std::countr_zero(min_block);
+  }
+  static Chunk* chunk_of(void* p) {
+    return reinterpret_cast<Chunk*>(reinterpret_cast<std::uintptr_t>(p) &
+                                    ~(chunk_size - 1));
+  }
+
+  // the blocks of class k other threads freed become the free list
+  void take_back(std::size_t k) {
+    auto& c = classes[k];
+    c.free = remote[k].exchange(nullptr, std::memory_order_acquire);
+    for (FreeBlock* b = c.free; b != nullptr; b = b->next)
+      stats.returned++;
+  }
+
+  // once the thread exits: the blocks still in use are the ones it
+  // allocated and didn't free, minus the ones others freed already
+  void retire() {
+    std::size_t delta = live - alive;
+    if (owed.fetch_add(delta, std::memory_order_acq_rel) + delta == 0)
+      delete this;
+  }
+
+  std::array<SizeClass, num_classes> classes;
+  std::array<std::atomic<FreeBlock*>, num_classes> remote{};
+  std::size_t live = 0; // allocated minus freed by this thread
+  std::atomic<std::size_t> owed{alive}; // minus the blocks others freed
+  std::vector<void*> chunks;
+  static inline thread_local Heap* current = nullptr;
+  friend Heap& heap();
+};
+
+// the heap of this thread
+Heap& heap() {
+  struct Owner {
+    Heap* h = new Heap;
+    Owner() { Heap::current = h; }
+    ~Owner() {
+      Heap::current = nullptr;
+      h->retire();
+    }
+  };
+  thread_local Owner owner;
+  return *owner.h;
+}
+
+// an allocator for the standard containers, on top of heap().
+template <class T>
+struct HeapAllocator {
+  using value_type = T;
+
+  HeapAllocator() = default;
+  template <class U>
+  HeapAllocator(const HeapAllocator<U>&) {}
+
+  T* allocate(std::size_t n) {
+    return static_cast<T*>(heap().allocate(n * sizeof(T)));
+  }
+  void deallocate(T* p, std::size_t n) {
+    Heap::deallocate(p, n * sizeof(T));
+  }
+
+  template <class U>
+  bool operator==(const HeapAllocator<U>&) const {
+    return true;
+  }
+};
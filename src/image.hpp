@@ -0,0 +1,658 @@
+#pragma once
+// Copyright 2023 Sofia Cerasuoli (@SwitchAxe)
+/*
+  This file is part of Rewind.
+  Rewind is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation, either version 3 of the license, or (at your
+  option) any later version.
+  Rewind is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Rewind. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "compiler.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "procedures.hpp"
+#include "types.hpp"
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+// Images: a parsed program, along with the bytecode of its functions, or a
+// snapshot of the globals of the interpreter, in a binary form that reads
+// back without lexing, parsing, compiling or evaluating anything again. An
+// image is only read by the same build of the interpreter that wrote it,
+// and anything wrong with it makes ImageReader give up, so the caller can
+// parse the source instead.
+//
+// The interned ids of names change from one run to the next, so an image
+// keeps a table of the names it uses, which are interned again when it's
+// read. A program's function compiled with the values of some globals
+// (see Chunk::folds_globals) is compiled again when it's read, for the
+// globals of that run, while a snapshot brings those globals along.
+// Integers are written as varints, since most of them are small: line
+// numbers, registers, counts and indices into the tables.
+
+enum class ImageKind : std::uint32_t { Program, Snapshot };
+
+struct ImageHeader {
+  char magic[8];
+  std::uint32_t format;
+  ImageKind kind;
+  std::uint64_t build; // see image_build
+  // the source a program was parsed from, and the rest of the image
+  std::uint64_t source_size;
+  std::uint64_t source_hash;
+  std::uint64_t body_size;
+  std::uint64_t body_hash;
+};
+
+constexpr char image_magic[8] = "REWIND\x01";
+// bumped whenever the layout of an image or the instructions change
+constexpr std::uint32_t image_format = 2;
+
+#ifndef REWIND_SOURCE_HASH
+#define REWIND_SOURCE_HASH 0 // not built by the makefile
+#endif
+
+std::uint64_t image_hash(std::string_view s) {
+  return std::hash<std::string_view>{}(s);
+}
+
+// tells this build of the interpreter apart from the others: the hash of
+// its sources the makefile passes, the format, and the instructions. The
+// date of the build isn't enough on its own, since reproducible builds pin
+// it (see SOURCE_DATE_EPOCH).
+const std::uint64_t image_build = image_hash(
+    std::to_string(REWIND_SOURCE_HASH) + " " + std::to_string(image_format) +
+    " " + std::to_string(int(OpCode::Return)) + " " +
+    std::to_string(sizeof(Instr)) + " " __DATE__ " " __TIME__);
+
+// The flags of a symbol in an image. The value of an identifier or an
+// operator is usually its name, which is then only written as its id.
+// A chunk is written once, after what it refers to, and numbered in that
+// order, and its other uses refer to that number.
+enum ImageFlags : std::uint8_t {
+  image_block = 1,
+  image_global = 2,
+  image_named = 4, // the value is the name of the id
+  image_new_code = 8,
+  image_same_code = 16,
+  image_compile_code = 32, // see Chunk::folds_globals
+};
+
+// the instructions whose b is the id of a name, see OpCode
+bool names_operand(OpCode op) {
+  return (op == OpCode::LoadVar) || (op == OpCode::Call) ||
+         (op == OpCode::TailCall) || (op == OpCode::Let) ||
+         (op == OpCode::CheckBool);
+}
+
+class ImageWriter {
+public:
+  // the image of 'root': a program parsed out of 'source', or a snapshot
+  std::string write(const Symbol& root, ImageKind _kind,
+                    std::string_view source = {}) {
+    kind = _kind;
+    body.clear();
+    symbol(root);
+    std::string rest;
+    std::swap(rest, body);
+    number(name_list.size());
+    for (auto id : name_list)
+      string(symbol_name(id));
+    rest = body + rest;
+    ImageHeader h{};
+    std::memcpy(h.magic, image_magic, sizeof h.magic);
+    h.format = image_format;
+    h.kind = kind;
+    h.build = image_build;
+    h.source_size = source.size();
+    h.source_hash = image_hash(source);
+    h.body_size = rest.size();
+    h.body_hash = image_hash(rest);
+    return std::string(reinterpret_cast<const char*>(&h), sizeof h) + rest;
+  }
+
+private:
+  void byte(std::uint8_t b) { body.push_back(static_cast<char>(b)); }
+
+  void number(std::uint64_t n) {
+    for (; n >= 0x80; n >>= 7)
+      byte(static_cast<std::uint8_t>(n | 0x80));
+    byte(static_cast<std::uint8_t>(n));
+  }
+  // zigzag, so that small negative numbers stay small too
+  void integer(std::int64_t n) {
+    number((static_cast<std::uint64_t>(n) << 1) ^
+           static_cast<std::uint64_t>(n >> 63));
+  }
+
+  void string(std::string_view s) {
+    number(s.size());
+    body.append(s);
+  }
+
+  // 0 for no_symbol, or one more than its place in the table of names
+  void name(SymbolId id) {
+    if (id == no_symbol) {
+      number(0);
+      return;
+    }
+    auto [it, added] = names.insert({id, name_list.size()});
+    if (added)
+      name_list.push_back(id);
+    number(it->second + 1);
+  }
+
+  void symbol(const Symbol& s) {
+    auto str = std::get_if<std::string>(&s.value);
+    bool named = str && (s.id != no_symbol) && (*str == symbol_name(s.id));
+    const Chunk* c = s.code.get();
+    std::uint8_t flags = (s.is_block ? image_block : 0) |
+                         (s.is_global ? image_global : 0) |
+                         (named ? image_named : 0);
+    auto known = c ? chunks.find(c) : chunks.end();
+    if (known != chunks.end())
+      flags |= image_same_code;
+    else if (c)
+      flags |= recompile(*c) ? image_compile_code : image_new_code;
+    byte(static_cast<std::uint8_t>(s.type));
+    byte(static_cast<std::uint8_t>(s.value.index()));
+    byte(flags);
+    integer(s.line);
+    name(s.id);
+    if (!named)
+      std::visit(overloaded{
+        [](std::monostate) {},
+        [&](long long int n) { integer(n); },
+        [&](const BigInt& n) { string(n.to_string()); },
+        [&](double d) {
+          body.append(reinterpret_cast<const char*>(&d), sizeof d);
+        },
+        [&](const std::string& x) { string(x); },
+        [&](bool b) { byte(b); },
+        [&](const List& l) { list(l); },
+        [&](const Map& m) {
+          number(m.size());
+          m.for_each([&](const Symbol& k, const Symbol& v) {
+            symbol(k);
+            symbol(v);
+          });
+        }
+      }, s.value);
+    if (known != chunks.end())
+      number(known->second);
+    else if (c) {
+      if (!recompile(*c))
+        chunk(*c);
+      chunks.insert({c, static_cast<std::uint32_t>(chunks.size())});
+    }
+  }
+
+  // the copies of a list share their elements (see Seq), which are only
+  // written once: a list is 0 and its elements, or one more than the
+  // number of the same list written before.
+  void list(const List& l) {
+    std::pair key{l.empty() ? nullptr : &l.front(), l.size()};
+    if (auto it = lists.find(key); !l.empty() && (it != lists.end())) {
+      number(it->second + 1);
+      return;
+    }
+    number(0);
+    number(l.size());
+    for (auto& x : l)
+      symbol(x);
+    if (!l.empty())
+      lists.insert({key, static_cast<std::uint32_t>(lists.size())});
+  }
+
+  bool recompile(const Chunk& c) const {
+    return (kind == ImageKind::Program) && c.folds_globals;
+  }
+
+  void chunk(const Chunk& c) {
+    number(c.code.size());
+    for (auto& in : c.code) {
+      byte(static_cast<std::uint8_t>(in.op));
+      integer(in.a);
+      if (names_operand(in.op))
+        name(static_cast<SymbolId>(in.b));
+      else
+        integer(in.b);
+      integer(in.c);
+      integer(in.d);
+      integer(in.e);
+    }
+    for (int line : c.lines)
+      integer(line);
+    number(c.pool.size());
+    for (auto& k : c.pool)
+      symbol(k);
+    number(c.params.size());
+    for (auto id : c.params)
+      name(id);
+    number(c.captures.size());
+    for (auto id : c.captures)
+      name(id);
+    byte(c.needs_env | (c.folds_globals << 1) | ((c.memo != nullptr) << 2));
+    integer(c.nregs);
+    // a memoized function starts over with none of its results
+    if (c.memo)
+      number(c.memo->max_size());
+  }
+
+  ImageKind kind = ImageKind::Program;
+  std::string body;
+  std::unordered_map<SymbolId, std::uint32_t> names;
+  std::vector<SymbolId> name_list;
+  std::map<std::pair<const Symbol*, std::size_t>, std::uint32_t> lists;
+  std::unordered_map<const Chunk*, std::uint32_t> chunks;
+};
+
+class ImageReader {
+public:
+  // what ImageWriter::write() was given, or nullopt if the image isn't of
+  // that kind (and source), this build of the interpreter didn't write it,
+  // or it's damaged
+  std::optional<Symbol> read(std::string_view image, ImageKind kind,
+                             std::string_view source = {}) {
+    ImageHeader h;
+    if (image.size() < sizeof h)
+      return std::nullopt;
+    std::memcpy(&h, image.data(), sizeof h);
+    in = image.substr(sizeof h);
+    if ((std::memcmp(h.magic, image_magic, sizeof h.magic) != 0) ||
+        (h.format != image_format) || (h.kind != kind) ||
+        (h.build != image_build) ||
+        (h.source_size != source.size()) || (h.body_size != in.size()) ||
+        (h.source_hash != image_hash(source)) ||
+        (h.body_hash != image_hash(in)))
+      return std::nullopt;
+    try {
+      for (auto n = count(1); n > 0; --n) {
+        auto s = string();
+        names.push_back({intern(s), s});
+      }
+      Symbol program = symbol();
+      if (at != in.size())
+        return std::nullopt;
+      return program;
+    } catch (Damaged) {
+      return std::nullopt;
+    }
+  }
+
+private:
+  struct Damaged {};
+
+  std::uint8_t byte() {
+    if (at == in.size())
+      throw Damaged{};
+    return static_cast<std::uint8_t>(in[at++]);
+  }
+
+  std::uint64_t number() {
+    std::uint64_t n = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+      auto b = byte();
+      n |= std::uint64_t(b & 0x7f) << shift;
+      if (!(b & 0x80))
+        return n;
+    }
+    throw Damaged{};
+  }
+  std::int64_t integer() {
+    auto n = number();
+    return static_cast<std::int64_t>(n >> 1) ^
+           -static_cast<std::int64_t>(n & 1);
+  }
+  // an integer that must fit in an int
+  int small() {
+    auto n = integer();
+    if ((n < INT32_MIN) || (n > INT32_MAX))
+      throw Damaged{};
+    return static_cast<int>(n);
+  }
+
+  // a count of things taking at least 'size' bytes each
+  std::size_t count(std::size_t size) {
+    auto n = number();
+    if (n > (in.size() - at) / size)
+      throw Damaged{};
+    return n;
+  }
+
+  std::string_view string() {
+    auto n = count(1);
+    at += n;
+    return in.substr(at - n, n);
+  }
+
+  struct Name {
+    SymbolId id;
+    std::string_view text;
+  };
+  const Name* name() {
+    auto i = number();
+    if (i == 0)
+      return nullptr;
+    if (i > names.size())
+      throw Damaged{};
+    return &names[i - 1];
+  }
+  SymbolId name_id() {
+    auto n = name();
+    return n ? n->id : no_symbol;
+  }
+
+  Symbol symbol() {
+    Symbol s;
+    auto type = byte();
+    auto index = byte();
+    auto flags = byte();
+    if ((type > static_cast<std::uint8_t>(Type::RawAst)) ||
+        (index >= std::variant_size_v<_Type>))
+      throw Damaged{};
+    s.type = static_cast<Type>(type);
+    s.is_block = flags & image_block;
+    s.is_global = flags & image_global;
+    s.line = small();
+    auto n = name();
+    s.id = n ? n->id : no_symbol;
+    if (flags & image_named) {
+      if (n == nullptr)
+        throw Damaged{};
+      s.value = std::string{n->text};
+    } else
+      value(s, index);
+    if (flags & image_same_code) {
+      auto i = number();
+      if (i >= chunks.size())
+        throw Damaged{};
+      s.code = chunks[i];
+    } else if (flags & image_compile_code) {
+      s.code = compile_function(s);
+      chunks.push_back(s.code);
+    } else if (flags & image_new_code) {
+      s.code = chunk();
+      chunks.push_back(s.code);
+    }
+    return s;
+  }
+
+  void value(Symbol& s, std::uint8_t index) {
+    switch (index) {
+    case 0:
+      break;
+    case 1:
+      s.value = static_cast<long long int>(integer());
+      break;
+    case 2: {
+      auto n = BigInt::parse(string());
+      if (n == std::nullopt)
+        throw Damaged{};
+      s.value = std::move(*n);
+      break;
+    }
+    case 3: {
+      double d;
+      if (in.size() - at < sizeof d)
+        throw Damaged{};
+      std::memcpy(&d, in.data() + at, sizeof d);
+      at += sizeof d;
+      s.value = d;
+      break;
+    }
+    case 4:
+      s.value = std::string{string()};
+      break;
+    case 5:
+      s.value = list();
+      break;
+    case 6:
+      s.value = byte() != 0;
+      break;
+    case 7: {
+      Map m;
+      for (auto n = count(2); n > 0; --n) {
+        Symbol k = symbol();
+        m = m.insert(k, symbol());
+      }
+      s.value = m;
+      break;
+    }
+    }
+  }
+
+  List list() {
+    if (auto i = number(); i != 0) {
+      if (i > lists.size())
+        throw Damaged{};
+      return lists[i - 1];
+    }
+    std::vector<Symbol> items(count(1));
+    if (items.empty())
+      return List{};
+    for (auto& x : items)
+      x = symbol();
+    lists.emplace_back(std::make_move_iterator(items.begin()),
+                       std::make_move_iterator(items.end()));
+    return lists.back();
+  }
+
+  std::shared_ptr<const Chunk> chunk() {
+    auto c = std::make_shared<Chunk>();
+    c->code.resize(count(6));
+    for (auto& instr : c->code) {
+      auto op = byte();
+      if (op > static_cast<std::uint8_t>(OpCode::Return))
+        throw Damaged{};
+      instr.op = static_cast<OpCode>(op);
+      instr.a = small();
+      instr.b = names_operand(instr.op) ? static_cast<int>(name_id())
+                                        : small();
+      instr.c = small();
+      instr.d = small();
+      instr.e = small();
+    }
+    c->lines.resize(c->code.size());
+    for (auto& line : c->lines)
+      line = small();
+    c->pool.resize(count(1));
+    for (auto& k : c->pool)
+      k = symbol();
+    c->params.resize(count(1));
+    for (auto& id : c->params)
+      id = name_id();
+    c->captures.resize(count(1));
+    for (auto& id : c->captures)
+      id = name_id();
+    auto flags = byte();
+    c->needs_env = flags & 1;
+    c->folds_globals = flags & 2;
+    c->nregs = small();
+    if (flags & 4)
+      c->memo = std::make_shared<MemoTable>(number());
+    c->caches.resize(c->code.size());
+    return c;
+  }
+
+  std::string_view in;
+  std::size_t at = 0;
+  std::vector<Name> names;
+  std::vector<List> lists;
+  std::vector<std::shared_ptr<const Chunk>> chunks;
+};
+
+// The script cache: the images of the programs 'rewind', 'preload' and the
+// config file parsed before, named after a hash of their source and of the
+// build of the interpreter, so a script that didn't change is only read
+// back, and two builds sharing the directory keep entries of their own. An
+// entry is written to a temporary file first, so that processes starting at
+// once never read half of one. Reading an entry touches it, and once the
+// entries take more than script_cache_limit bytes, the ones read least
+// recently are removed.
+
+constexpr std::uintmax_t script_cache_limit = 64 << 20;
+
+// $REWIND_CACHE, or rewind/ in $XDG_CACHE_HOME or ~/.cache. An empty
+// $REWIND_CACHE turns the cache off.
+std::optional<std::filesystem::path> script_cache_dir() {
+  if (auto dir = rewind_get_env_var("REWIND_CACHE"))
+    return dir->empty() ? std::nullopt
+                        : std::optional<std::filesystem::path>{*dir};
+  if (auto xdg = rewind_get_env_var("XDG_CACHE_HOME"); xdg && !xdg->empty())
+    return std::filesystem::path{*xdg} / "rewind";
+  if (auto home = rewind_get_env_var("HOME"); home && !home->empty())
+    return std::filesystem::path{*home} / ".cache" / "rewind";
+  return std::nullopt;
+}
+
+// the name of the entry of a source, for this build
+std::string script_cache_entry(std::string_view source) {
+  std::uint64_t h = image_hash(source);
+  h ^= image_build + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+  char name[32];
+  std::snprintf(name, sizeof name, "%016llx.rwi",
+                static_cast<unsigned long long>(h));
+  return name;
+}
+
+// removes the entries read least recently, until the rest fit in the limit
+void prune_script_cache(const std::filesystem::path& dir) {
+  namespace fs = std::filesystem;
+  std::vector<std::pair<fs::file_time_type, fs::directory_entry>> entries;
+  std::uintmax_t total = 0;
+  std::error_code ec;
+  for (auto& e : fs::directory_iterator(dir, ec)) {
+    if ((e.path().extension() != ".rwi") || !e.is_regular_file(ec))
+      continue;
+    auto size = e.file_size(ec);
+    auto time = e.last_write_time(ec);
+    if (ec)
+      continue;
+    total += size;
+    entries.emplace_back(time, e);
+  }
+  if (total <= script_cache_limit)
+    return;
+  std::sort(entries.begin(), entries.end(),
+            [](auto& a, auto& b) { return a.first < b.first; });
+  for (auto& [time, e] : entries) {
+    if (total <= script_cache_limit)
+      break;
+    total -= e.file_size(ec);
+    fs::remove(e.path(), ec);
+  }
+}
+
+// like parse_source(source), from the cache when it's there
+Symbol parse_cached(std::string_view source) {
+  auto dir = script_cache_dir();
+  if (dir == std::nullopt)
+    return parse_source(source);
+  auto entry = *dir / script_cache_entry(source);
+  std::error_code ec;
+  {
+    MappedFile image(entry.string());
+    auto program = ImageReader{}.read(image.view(), ImageKind::Program, source);
+    if (program != std::nullopt) {
+      std::filesystem::last_write_time(
+          entry, std::filesystem::file_time_type::clock::now(), ec);
+      return *program;
+    }
+  }
+  Symbol program = parse_source(source);
+  // the cache is only ever a shortcut: failing to write it isn't an error
+  std::filesystem::create_directories(*dir, ec);
+  ec.clear();
+  // unique to this write, as other engines of the process may be writing
+  // the same entry
+  static std::atomic<std::uint64_t> writes = 0;
+  auto tmp = entry;
+  tmp += "." + std::to_string(getpid()) + "." + std::to_string(++writes);
+  {
+    std::ofstream out(tmp, std::ios::binary);
+    auto image = ImageWriter{}.write(program, ImageKind::Program, source);
+    out.write(image.data(), image.size());
+    if (!out)
+      ec = std::make_error_code(std::errc::io_error);
+  }
+  if (!ec)
+    std::filesystem::rename(tmp, entry, ec);
+  if (ec)
+    std::filesystem::remove(tmp, ec);
+  else
+    prune_script_cache(*dir);
+  return program;
+}
+
+// Snapshots: the globals of the interpreter once the config file ran, with
+// everything it loaded, and the prompt it ended with (see
+// rewind_read_config()), for 'rewind --dump-image' and 'rewind --image'.
+// The builtins are part of the executable, so there's nothing to save
+// about them.
+
+void dump_snapshot(const std::string& filename,
+                   const std::optional<Symbol>& prompt) {
+  auto& constants = interp().constants;
+  // the functions 'load' left for later are saved like the others
+  while (!constants.lazy.empty())
+    constants.find(constants.lazy.begin()->first);
+  List globals;
+  constants.for_each([&](SymbolId id, const Symbol& value) {
+    globals.push_back(Symbol(symbol_name(id), Type::Identifier));
+    globals.push_back(value);
+  });
+  List last;
+  if (prompt != std::nullopt)
+    last.push_back(*prompt);
+  Symbol state(List{Symbol(globals, Type::List), Symbol(last, Type::List)},
+               Type::List);
+  auto image = ImageWriter{}.write(state, ImageKind::Snapshot);
+  std::ofstream out(filename, std::ios::binary);
+  out.write(image.data(), image.size());
+  if (!out)
+    throw std::logic_error{"Couldn't write the image " + filename + "!\n"};
+}
+
+// binds the globals of the snapshot, and sets 'prompt'. False if there's
+// no snapshot in the file this build can read.
+bool load_snapshot(const std::string& filename,
+                   std::optional<Symbol>& prompt) {
+  MappedFile image(filename);
+  auto state = ImageReader{}.read(image.view(), ImageKind::Snapshot);
+  if (state == std::nullopt)
+    return false;
+  auto& parts = std::get<List>(state->value);
+  if ((parts.size() != 2) ||
+      !std::holds_alternative<List>(parts.front().value) ||
+      !std::holds_alternative<List>(parts.back().value))
+    return false;
+  auto& globals = std::get<List>(parts.front().value);
+  for (std::size_t i = 0; i + 1 < globals.size(); i += 2)
+    interp().constants.insert({globals[i].id, globals[i + 1]});
+  auto& last = std::get<List>(parts.back().value);
+  prompt = last.empty() ? std::nullopt : std::optional<Symbol>{last.front()};
+  return true;
+}
@@ -3,4 +3,5 @@
 #include "lexer.hpp"
 #include "parser.hpp"
 #include "procedures.hpp"
-Symbol eval(Symbol root, const path& PATH, variables& vars, int line);
+Symbol eval(Symbol root, const path& PATH, variables& vars, int line,
+            bool tail);
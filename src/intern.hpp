@@ -0,0 +1,84 @@
+#pragma once
+// Copyright 2023 Sofia Cerasuoli (@SwitchAxe)
+/*
+  This file is part of Rewind.
+  Rewind is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation, either version 3 of the license, or (at your
+  option) any later version.
+  Rewind is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Rewind. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Every identifier, operator and builtin name is interned once, when it's
+// parsed, into a small integer. Environments, the builtin table and the
+// special form checks are keyed on these ids, so looking a name up never
+// has to hash or compare the whole string again.
+using SymbolId = std::uint32_t;
+constexpr SymbolId no_symbol = UINT32_MAX;
+
+// these are interned first, so their ids are 0...special_forms.size() - 1
+std::array<std::string, 10> special_forms = {
+    "->", "let", "if", "$", "cond", "match", "<<<", "defined", "and", "or"};
+
+// shared between the threads of the parallel builtins: names are added
+// under the lock, and kept in a deque so that the references symbol_name()
+// returns stay valid.
+struct Interner {
+  std::unordered_map<std::string, SymbolId> ids;
+  std::deque<std::string> names;
+  std::shared_mutex m;
+
+  Interner() {
+    for (auto& s : special_forms)
+      intern(s);
+  }
+
+  SymbolId intern(std::string_view s) {
+    std::string key{s};
+    {
+      std::shared_lock lock(m);
+      if (auto it = ids.find(key); it != ids.end())
+        return it->second;
+    }
+    std::unique_lock lock(m);
+    if (auto it = ids.find(key); it != ids.end())
+      return it->second;
+    SymbolId id = names.size();
+    names.emplace_back(s);
+    ids.insert({names.back(), id});
+    return id;
+  }
+
+  const std::string& name(SymbolId id) {
+    std::shared_lock lock(m);
+    return names[id];
+  }
+};
+
+// a function-local static, so that the static Symbols in the builtins can
+// intern their names during static initialization.
+Interner& interner() {
+  static Interner table;
+  return table;
+}
+
+SymbolId intern(std::string_view s) { return interner().intern(s); }
+
+const std::string& symbol_name(SymbolId id) { return interner().name(id); }
+
+bool is_special_form(SymbolId id) { return id < special_forms.size(); }
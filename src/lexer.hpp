@@ -15,20 +15,29 @@
   Rewind. If not, see <https://www.gnu.org/licenses/>.
 */
 #include "types.hpp"
+#include <array>
 #include <cctype>
+#include <charconv>
+#include <cstdint>
 #include <exception>
 #include <ios>
+#include <sstream>
 #include <stdexcept>
+#include <string>
+#include <string_view>
 #include <vector>
-#include <charconv>
-#include <sstream>
-std::string process_escapes(const std::string &s) {
+std::string process_escapes(std::string_view s) {
   std::string r;
-  for (int i = 0; i < s.length(); ++i) {
+  r.reserve(s.size());
+  for (std::size_t i = 0; i < s.size(); ++i) {
     if (!(s[i] == '\\')) {
       r += s[i];
       continue;
     }
+    if (i + 1 == s.size()) {
+      r += s[i];
+      break;
+    }
     switch (s[i + 1]) {
     case 'n':
       r += '\n';
@@ -59,7 +68,7 @@ std::string process_escapes(const std::string &s) {
       break;
     case '0': {
       // 3 digits of octal numerical code must follow
-      std::stringstream ss{s.substr(i + 2, 3)};
+      std::stringstream ss{std::string{s.substr(std::min(i + 2, s.size()), 3)}};
       std::stringstream as_oct;
       as_oct << std::oct << ss.str();
       int n;
@@ -79,102 +88,101 @@ std::string process_escapes(const std::string &s) {
   return r;
 }
 
+// A token is a view into the source it was read from, which must outlive
+// it: the lexer copies nothing. The escapes of a string literal are only
+// processed once it's parsed, see parse_strlit().
 struct Token {
-  std::string tk;
+  std::string_view tk;
   int line;
+  std::size_t offset = 0; // of the first byte of the token in the source
+};
+
+enum class CharClass : std::uint8_t {
+  Other, // part of an identifier or a number
+  Blank, // ends a token, like any other byte that isn't printable
+  Newline,
+  Special, // a token by itself
+  Quote,
 };
 
-std::vector<Token> get_tokens(std::string stream) {
-  bool in_identifier = false;
-  bool in_numlit = false;
-  bool crossed_lparen = false;
-  bool crossed_rparen = false;
+constexpr std::array<CharClass, 256> char_classes = [] {
+  std::array<CharClass, 256> t{};
+  for (int c = 0; c < 256; ++c)
+    t[c] = ((c > ' ') && (c < 127)) ? CharClass::Other : CharClass::Blank;
+  t['\n'] = CharClass::Newline;
+  for (char c : std::string_view{"[](),;{}|"})
+    t[static_cast<unsigned char>(c)] = CharClass::Special;
+  t['"'] = t['\''] = CharClass::Quote;
+  return t;
+}();
+
+constexpr CharClass char_class(char c) {
+  return char_classes[static_cast<unsigned char>(c)];
+}
+
+// Splits the source in tokens, in a single pass. A line whose first
+// printable character is a '#' is a comment, and is skipped.
+std::vector<Token> get_tokens(std::string_view stream) {
   std::vector<Token> tokens;
-  std::vector<char> special_tokens = {
-    '[', ']',
-    '(', ')',
-    ',', ';',
-    '{', '}',
-    '|',
-  };
-  std::string temp;
+  tokens.reserve(stream.size() / 4);
   int line = 0;
-  for (int i = 0; i < stream.length(); ++i) {
-    if (stream[i] == '\n') {
-      in_identifier = false;
-      in_numlit = false;
-      if (temp != "")
-	tokens.push_back(Token{.tk = temp, .line = line});
-      temp = "";
+  std::size_t start = std::string_view::npos; // of the token being read
+  bool line_start = true; // nothing printable on this line yet
+  auto flush = [&](std::size_t end) {
+    if (start != std::string_view::npos)
+      tokens.push_back(Token{.tk = stream.substr(start, end - start),
+                             .line = line,
+                             .offset = start});
+    start = std::string_view::npos;
+  };
+  for (std::size_t i = 0; i < stream.size(); ++i) {
+    char c = stream[i];
+    switch (char_class(c)) {
+    case CharClass::Newline:
+      flush(i);
       line++;
+      line_start = true;
+      continue;
+    case CharClass::Blank:
+      flush(i);
+      continue;
+    default:
+      break;
     }
-    if ((stream[i] == ' ') || (stream[i] == '\t')) {
-      if (temp != "")
-        tokens.push_back(Token{.tk = temp, .line = line});
-      in_identifier = false;
-      in_numlit = false;
-      temp = "";
-    } else if (isgraph(stream[i])) {
-      if (auto s = std::string{stream[i], stream[i+1]}; (s == "'(") || (s == "'[")) {
-	if (temp != "") {
-	  tokens.push_back(Token{.tk = std::string{temp}, .line = line});
-	  temp = "";
-	}
-	tokens.push_back(Token{.tk = s, .line = line});
-	i++;
-      } else if (std::find(special_tokens.begin(), special_tokens.end(),
-                    stream[i]) != special_tokens.end()){
-	if (temp != "") {
-	  tokens.push_back(Token{.tk = std::string{temp}, .line = line});
-	  temp = "";
-	}
-	tokens.push_back(Token{.tk = std::string{stream[i]}, .line = line});
-      }
-      else if ((stream[i] == '"') || (stream[i] == '\'')) {
-        if (in_numlit) {
-          throw std::logic_error{"Failed to parse the input stream!\n"
-                                 "Found double quotes in a numeric literal!\n"};
-        } else if (in_identifier) {
-          throw std::logic_error{
-              "Failed to parse the input stream!\n"
-              "Found double quotes in an identifier (illegal character)!\n"};
-        } else {
-          in_identifier = false;
-          in_numlit = false;
-          int e = 0;
-          for (e = i + 1; (e < stream.length()) &&
-                          (stream[e] != (stream[i] == '"' ? '"' : '\''));
-               ++e) {
-            if (stream[e] == '\\') {
-              e++;
-            }
-          }
-          std::string tmp = stream.substr(i, e - i + 1);
-          i = e;
-          tokens.push_back(Token{.tk = tmp, .line = line});
-          tmp = "";
-          temp = "";
-        }
-      } else if (in_identifier) {
-        temp += stream[i];
-      } else if (in_numlit) {
-        if (!isdigit(stream[i]))
-          throw std::logic_error{"Failed to parse the input stream!\n"
-                                 "Found a character in a numeric literal!\n"};
-        temp += stream[i];
-      } else {
-        in_identifier = true;
-        temp += stream[i];
-      }
+    if (line_start && (c == '#')) {
+      i = std::min(stream.find('\n', i), stream.size()) - 1;
+      continue;
     }
-  }
-  if (temp != "") {
-    tokens.push_back(Token{.tk = temp, .line = line});
-  }
-  for (auto &tk : tokens) {
-    if (tk.tk[0] == '"') {
-      tk = Token {.tk = process_escapes(tk.tk), .line = tk.line};
+    line_start = false;
+    if ((c == '\'') && (i + 1 < stream.size()) &&
+        ((stream[i + 1] == '(') || (stream[i + 1] == '[') ||
+         (stream[i + 1] == '{'))) {
+      flush(i);
+      tokens.push_back(
+          Token{.tk = stream.substr(i, 2), .line = line, .offset = i});
+      i++;
+    } else if (char_class(c) == CharClass::Special) {
+      flush(i);
+      tokens.push_back(
+          Token{.tk = stream.substr(i, 1), .line = line, .offset = i});
+    } else if (char_class(c) == CharClass::Quote) {
+      if (start != std::string_view::npos)
+        throw std::logic_error{
+            "Failed to parse the input stream!\n"
+            "Found double quotes in an identifier (illegal character)!\n"};
+      std::size_t e = i + 1;
+      while ((e < stream.size()) && (stream[e] != c))
+        e += (stream[e] == '\\') ? 2 : 1;
+      e = std::min(e, stream.size() - 1);
+      tokens.push_back(
+          Token{.tk = stream.substr(i, e - i + 1), .line = line, .offset = i});
+      i = e;
+    } else if (start == std::string_view::npos) {
+      start = i;
     }
   }
+  flush(stream.size());
   return tokens;
 }
+// the tokens would outlive the string
+std::vector<Token> get_tokens(std::string&&) = delete;
@@ -0,0 +1,248 @@
+// Copyright 2023 Sofia Cerasuoli (@SwitchAxe)
+/*
+  This file is part of Rewind.
+  Rewind is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation, either version 3 of the license, or (at your
+  option) any later version.
+  Rewind is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Rewind. If not, see <https://www.gnu.org/licenses/>.
+*/
+// The single translation unit of librewind, like main.cpp is for the
+// executable: the interpreter behind the API in rewind.hpp.
+#include "src/rewind.hpp"
+#include "src/evaluator.hpp"
+#include "src/external.hpp"
+#include "src/lexer.hpp"
+#include "src/parser.hpp"
+#include "src/procedures.hpp"
+#include "src/vm.hpp"
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace librewind {
+
+struct ValueData {
+  Symbol s;
+};
+
+struct Access {
+  static Value make(Symbol s) {
+    Value v;
+    v.data = std::make_shared<const ValueData>(ValueData{std::move(s)});
+    return v;
+  }
+  static const Symbol& symbol(const Value& v) {
+    static const Symbol nothing;
+    return v.data ? v.data->s : nothing;
+  }
+  static List list(const std::vector<Value>& values) {
+    List l;
+    for (auto& v : values)
+      l.push_back(symbol(v));
+    return l;
+  }
+};
+
+namespace {
+// the evaluation of a run leaves nothing behind, even when it throws
+template <class F>
+Symbol run_on(Interpreter& rt, F body) {
+  Interpreter::Use use(rt);
+  auto depth = rt.call_stack.size();
+  try {
+    return body();
+  } catch (...) {
+    rt.call_stack.resize(depth);
+    rt.environment_variables.clear();
+    throw;
+  }
+}
+
+std::logic_error wrong_kind(const char* expected) {
+  return std::logic_error{std::string{"librewind::Value: not "} + expected +
+                          "!\n"};
+}
+} // namespace
+
+Value::Value() = default;
+Value::Value(long long int n) : Value(Access::make(Symbol(n, Type::Number))) {}
+Value::Value(double d) : Value(Access::make(Symbol(d, Type::Number))) {}
+Value::Value(bool b) : Value(Access::make(Symbol(b, Type::Boolean))) {}
+Value::Value(std::string s)
+    : Value(Access::make(Symbol(std::move(s), Type::String))) {}
+Value::Value(const std::vector<Value>& l)
+    : Value(Access::make(Symbol(Access::list(l), Type::List))) {}
+
+Value::Kind Value::kind() const {
+  const Symbol& s = Access::symbol(*this);
+  return std::visit(overloaded{
+    [](std::monostate) { return Kind::Nothing; },
+    [](long long int) { return Kind::Integer; },
+    [](const BigInt&) { return Kind::BigInteger; },
+    [](double) { return Kind::Double; },
+    [](const std::string&) { return Kind::String; },
+    [](bool) { return Kind::Boolean; },
+    [](const Map&) { return Kind::Map; },
+    [&](const List&) {
+      return (s.type == Type::Function) ? Kind::Function : Kind::List;
+    }
+  }, s.value);
+}
+
+long long int Value::integer() const {
+  if (auto n = std::get_if<long long int>(&Access::symbol(*this).value))
+    return *n;
+  throw wrong_kind("an integer");
+}
+
+double Value::number() const {
+  return std::visit(overloaded{
+    [](long long int n) { return double(n); },
+    [](const BigInt& n) { return n.to_double(); },
+    [](double d) { return d; },
+    [](const auto&) -> double { throw wrong_kind("a number"); }
+  }, Access::symbol(*this).value);
+}
+
+bool Value::boolean() const {
+  if (auto b = std::get_if<bool>(&Access::symbol(*this).value))
+    return *b;
+  throw wrong_kind("a boolean");
+}
+
+std::string Value::string() const {
+  if (auto s = std::get_if<std::string>(&Access::symbol(*this).value))
+    return *s;
+  throw wrong_kind("a string");
+}
+
+std::vector<Value> Value::list() const {
+  if (kind() != Kind::List)
+    throw wrong_kind("a list");
+  std::vector<Value> l;
+  for (auto& x : std::get<List>(Access::symbol(*this).value))
+    l.push_back(Access::make(x));
+  return l;
+}
+
+std::vector<std::pair<Value, Value>> Value::entries() const {
+  auto m = std::get_if<Map>(&Access::symbol(*this).value);
+  if (m == nullptr)
+    throw wrong_kind("a map");
+  std::vector<std::pair<Value, Value>> l;
+  m->for_each([&](const Symbol& k, const Symbol& v) {
+    l.emplace_back(Access::make(k), Access::make(v));
+  });
+  return l;
+}
+
+std::string Value::str() const { return rec_print_ast(Access::symbol(*this)); }
+
+struct Engine::Impl {
+  Interpreter rt;
+  path PATH;
+  variables toplevel;
+};
+
+Engine::Engine(Options options) : impl(std::make_unique<Impl>()) {
+  impl->rt.reference_mode = options.reference;
+  impl->PATH = std::move(options.path);
+  if (impl->PATH.empty())
+    impl->PATH = rewind_get_system_PATH().value_or(path{});
+}
+Engine::~Engine() = default;
+Engine::Engine(Engine&&) noexcept = default;
+Engine& Engine::operator=(Engine&&) noexcept = default;
+
+void Engine::define(std::string_view name, const Value& v) {
+  Interpreter::Use use(impl->rt);
+  if (!impl->rt.constants.insert({intern(name), Access::symbol(v)}))
+    throw std::logic_error{"'" + std::string{name} + "' is already bound!\n"};
+}
+
+void Engine::define_builtin(std::string_view name, Native fn, int arity) {
+  Interpreter::Use use(impl->rt);
+  impl->rt.define_builtin(name, [fn = std::move(fn)](List args) {
+    std::vector<Value> values;
+    for (auto& x : args)
+      values.push_back(Access::make(x));
+    return Access::symbol(fn(values));
+  }, arity);
+}
+
+Value Engine::eval(std::string_view source) {
+  return Access::make(run_on(impl->rt, [&] {
+    Symbol ast = parse_source(source);
+    Symbol result;
+    for (auto& form : std::get<List>(ast.value))
+      result = run_toplevel(form, impl->PATH, impl->toplevel);
+    return result;
+  }));
+}
+
+// a script is compiled as the body of a function taking its parameters,
+// so every run gets a fresh scope, and only costs a call.
+struct Script::Impl {
+  Engine::Impl* engine;
+  Symbol function;
+  std::vector<SymbolId> params;
+  std::vector<Value> bound;
+};
+
+Script Engine::compile(std::string_view source,
+                       const std::vector<std::string>& params) {
+  auto script = std::make_shared<Script::Impl>();
+  script->engine = impl.get();
+  script->bound.resize(params.size());
+  List names;
+  for (auto& p : params) {
+    names.push_back(Symbol(p, Type::Identifier));
+    script->params.push_back(names.back().id);
+  }
+  run_on(impl->rt, [&] {
+    List body = std::get<List>(parse_source(source).value);
+    // a 'let' of the script binds a local, not a global
+    for (auto& form : body)
+      form.is_global = false;
+    script->function = Symbol(List{Symbol(names, Type::List),
+                                   Symbol(body, Type::List)},
+                              Type::Function);
+    script->function.code = compile_function(script->function);
+    return Symbol();
+  });
+  return Script(std::move(script));
+}
+
+Script::Script(std::shared_ptr<Impl> _impl) : impl(std::move(_impl)) {}
+
+Script& Script::bind(std::string_view param, const Value& v) {
+  auto it = std::find(impl->params.begin(), impl->params.end(),
+                      intern(param));
+  if (it == impl->params.end())
+    throw std::logic_error{"'" + std::string{param} +
+                           "' is not a parameter of the script!\n"};
+  impl->bound[it - impl->params.begin()] = v;
+  return *this;
+}
+
+Value Script::run() const { return run(impl->bound); }
+
+Value Script::run(const std::vector<Value>& args) const {
+  auto& engine = *impl->engine;
+  return Access::make(run_on(engine.rt, [&] {
+    if (engine.rt.reference_mode || (impl->function.code == nullptr))
+      return apply_function(impl->function, Access::list(args), engine.PATH);
+    static const SymbolId name = intern("(script)");
+    return vm_call(name, impl->function, Access::list(args), engine.PATH);
+  }));
+}
+
+} // namespace librewind
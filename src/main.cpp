@@ -16,21 +16,26 @@
 #include "shell/shell.hpp"
 #include "src/evaluator.hpp"
 #include "src/external.hpp"
+#include "src/image.hpp"
 #include "src/lexer.hpp"
 #include "src/parser.hpp"
 #include "src/procedures.hpp"
+#include "src/vm.hpp"
 #include <exception>
 #include <signal.h>
 #include <string>
 #include <sys/types.h>
 #include <termios.h>
+// the interpreter running the shell, or the script given on the command line
+static Interpreter interpreter;
 static void catch_SIGINT(int sig) {
-  for (auto p : active_pids) {
+  for (auto p : interpreter.active_pids) {
     kill(p, SIGINT);
   }
-  active_pids = {};
+  interpreter.active_pids = {};
 }
 int main(int argc, char **argv) {
+  Interpreter::Use use(interpreter);
   tcgetattr(STDIN_FILENO, &original);
   // enable some sort of "pseudo raw" mode where characters are
   // available immediately, without modifying anything else
@@ -39,12 +44,42 @@ int main(int argc, char **argv) {
   immediate.c_lflag &= ~ECHO;
   immediate.c_cc[VMIN] = 1;
   signal(SIGINT, catch_SIGINT);
+  if ((argc > 1) && (std::string{argv[1]} == "--reference")) {
+    // run everything on the tree-walking evaluator, skipping the VM.
+    interpreter.reference_mode = true;
+    argc--;
+    argv++;
+  }
+  // --image FILE starts from a snapshot instead of running the config
+  // file, and --dump-image FILE saves one once the config file ran. See
+  // image.hpp.
+  std::optional<std::string> image, dump_image;
+  if ((argc > 2) && (std::string{argv[1]} == "--image"))
+    image = argv[2];
+  else if ((argc > 2) && (std::string{argv[1]} == "--dump-image"))
+    dump_image = argv[2];
+  if (image || dump_image) {
+    argc -= 2;
+    argv += 2;
+  }
   auto PATH = rewind_get_system_PATH();
   std::optional<Symbol> conf;
-  if (PATH != std::nullopt)
-    conf = rewind_read_config(*PATH);
-  else {
-    conf = rewind_read_config({});
+  if (image && !load_snapshot(*image, conf)) {
+    std::cerr << "Can't read the image " << *image
+              << ", running the config file instead.\n";
+    image = std::nullopt;
+  }
+  if (image == std::nullopt) {
+    if (PATH != std::nullopt)
+      conf = rewind_read_config(*PATH);
+    else {
+      conf = rewind_read_config({});
+    }
+  }
+  if (dump_image) {
+    dump_snapshot(*dump_image, conf);
+    tcsetattr(STDIN_FILENO, TCSANOW, &original);
+    return 0;
   }
   if ((argc > 2) && (std::string{argv[1]} == "--silent")) {
     // Rewind will execute the single expression taken as input, and then exit.
@@ -52,9 +87,9 @@ int main(int argc, char **argv) {
     path p = {};
     if (PATH != std::nullopt) p = *PATH;
     try {
-      Symbol ast = parse(get_tokens(std::string{argv[2]}));
+      Symbol ast = parse(get_tokens(std::string_view{argv[2]}));
       variables vs = {};
-      std::cout << rec_print_ast(eval(ast, p, vs, 0)) << "\n";
+      std::cout << rec_print_ast(run_toplevel(ast, p, vs)) << "\n";
     } catch (std::exception e) {
       std::cout << "Exception: " << e.what() << "\n";
     }
@@ -65,49 +100,49 @@ int main(int argc, char **argv) {
   if ((argc > 1) && (std::string{argv[1]} == "--")) {
     for (int i = 1; i < argc; ++i) {
       std::string __argvi{argv[i]};
-      Symbol sym = Symbol("", __argvi, Type::String);
-      cmdline_args.insert({std::to_string(i - 1), eval(sym, *PATH)});
+      Symbol sym = Symbol(__argvi, Type::String);
+      interpreter.cmdline_args.insert(
+          {std::to_string(i - 1), eval(sym, *PATH)});
     }
     tcsetattr(STDIN_FILENO, TCSANOW, &original);
   } else if (argc > 2) {
     std::string filename{argv[1]};
-    std::string expr = rewind_read_file(filename);
+    MappedFile expr(filename);
     if (std::string{argv[2]} != "--") {
       throw std::logic_error{
           "please separate the script name from the arguments with '--'!\n"};
     }
     for (int i = 2; i < argc; ++i) {
       std::string __argvi{argv[i]};
-      Symbol sym = Symbol("", __argvi, Type::String);
-      cmdline_args.insert({std::to_string(i - 2), eval(sym, *PATH)});
+      Symbol sym = Symbol(__argvi, Type::String);
+      interpreter.cmdline_args.insert(
+          {std::to_string(i - 2), eval(sym, *PATH)});
     }
     path p = {};
     if (PATH != std::nullopt) p = *PATH;
-    std::vector<Token> tokens = get_tokens(expr);
-    Symbol ast = parse(tokens);
+    Symbol ast = parse_cached(expr.view());
     Symbol result;
     variables vs = {};
-    for (auto x : std::get<std::list<Symbol>>(ast.value))
-      result = eval(x, p, vs, x.line);
+    for (auto x : std::get<List>(ast.value))
+      result = run_toplevel(x, p, vs);
     std::cout << rec_print_ast(result) << "\n";
     tcsetattr(STDIN_FILENO, TCSANOW, &original);
     return 0;
   } else if (argc > 1) {
     std::string filename{argv[1]};
-    std::string expr = rewind_read_file(filename);
+    MappedFile expr(filename);
     path p = {};
     if (PATH != std::nullopt) p = *PATH;
-    auto tokens = get_tokens(expr);
-    Symbol ast = parse(tokens);
+    Symbol ast = parse_cached(expr.view());
     variables vs = {};
     Symbol result;
-    for (auto x : std::get<std::list<Symbol>>(ast.value))
-      result = eval(x, p, vs, x.line);
+    for (auto x : std::get<List>(ast.value))
+      result = run_toplevel(x, p, vs);
     std::cout << rec_print_ast(result) << "\n";
     tcsetattr(STDIN_FILENO, TCSANOW, &original);
     return 0;
   }
   tcsetattr(STDIN_FILENO, TCSANOW, &original);
-  rewind_sh_loop();
+  rewind_sh_loop(conf);
   return 0;
 }
@@ -0,0 +1,303 @@
+#pragma once
+// Copyright 2023 Sofia Cerasuoli (@SwitchAxe)
+/*
+  This file is part of Rewind.
+  Rewind is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation, either version 3 of the license, or (at your
+  option) any later version.
+  Rewind is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Rewind. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "types.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <variant>
+#include <vector>
+
+// Structural hashing and equality of values, for the keys of a Map and the
+// arguments of a memoized function (see memo.hpp). Two values are the same
+// if they hold the same value in the same representation, so 1 and 1.0 are
+// different keys.
+
+std::size_t hash_value(const Symbol& s);
+bool same_value(const Symbol& a, const Symbol& b);
+
+std::size_t hash_values(const List& l) {
+  std::size_t h = l.size();
+  for (auto& x : l)
+    h ^= hash_value(x) + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+  return h;
+}
+
+bool same_values(const List& a, const List& b) {
+  return std::equal(a.begin(), a.end(), b.begin(), b.end(), same_value);
+}
+
+// the same for any two symbols that are same_value()
+std::size_t hash_value(const Symbol& s) {
+  std::size_t h = static_cast<std::size_t>(s.type) * 31 + s.value.index();
+  if ((s.type == Type::Function) && s.code)
+    return h ^ std::hash<const void*>{}(s.code.get());
+  return h ^ std::visit(overloaded{
+    [](std::monostate) -> std::size_t { return 0; },
+    [](long long int n) { return std::hash<long long int>{}(n); },
+    [](const BigInt& n) { return std::hash<std::string>{}(n.to_string()); },
+    [](double d) { return std::hash<double>{}(d); },
+    [](const std::string& str) { return std::hash<std::string>{}(str); },
+    [](bool b) { return std::hash<bool>{}(b); },
+    [](const List& l) { return hash_values(l); },
+    [](const Map& m) {
+      // whatever order the entries are visited in
+      std::size_t sum = m.size();
+      m.for_each([&](const Symbol& k, const Symbol& v) {
+        sum += hash_value(k) * 31 + hash_value(v);
+      });
+      return sum;
+    }
+  }, s.value);
+}
+
+// two copies of a compiled function share their code
+bool same_value(const Symbol& a, const Symbol& b) {
+  if ((a.type != b.type) || (a.value.index() != b.value.index()))
+    return false;
+  if ((a.type == Type::Function) && a.code && b.code)
+    return a.code == b.code;
+  if (auto l = std::get_if<List>(&a.value))
+    return same_values(*l, std::get<List>(b.value));
+  return a.value == b.value;
+}
+
+// The map is a hash array mapped trie: every level of the tree takes 5 more
+// bits of the hash of a key, to pick one of the 32 slots of a node. A slot
+// holds either an entry or a child node, and only the slots in use take
+// room: a bitmap of each kind tells them apart, and the position of a slot
+// among the used ones is the number of bits set below it. Once the hash
+// runs out, the keys left are in a plain list.
+struct Map::Node {
+  struct Entry {
+    std::size_t hash;
+    Symbol key;
+    Symbol value;
+  };
+  std::uint32_t datamap = 0; // the slots holding an entry
+  std::uint32_t nodemap = 0; // the slots holding a child
+  std::vector<Entry> entries; // in slot order
+  std::vector<std::shared_ptr<const Node>> children; // in slot order
+
+  static constexpr unsigned bits = 5;
+  static constexpr unsigned hash_bits = 8 * sizeof(std::size_t);
+
+  static std::uint32_t bit(std::size_t hash, unsigned shift) {
+    return 1u << ((hash >> shift) & 31);
+  }
+  static std::size_t index(std::uint32_t bitmap, std::uint32_t bit) {
+    return std::popcount(bitmap & (bit - 1));
+  }
+
+  template <class F>
+  void for_each(F& f) const {
+    for (auto& e : entries)
+      f(e.key, e.value);
+    for (auto& c : children)
+      c->for_each(f);
+  }
+
+  const Symbol* find(const Symbol& key, std::size_t hash,
+                     unsigned shift) const {
+    if (shift >= hash_bits) {
+      for (auto& e : entries)
+        if (same_value(e.key, key))
+          return &e.value;
+      return nullptr;
+    }
+    std::uint32_t b = bit(hash, shift);
+    if (datamap & b) {
+      auto& e = entries[index(datamap, b)];
+      return ((e.hash == hash) && same_value(e.key, key)) ? &e.value
+                                                          : nullptr;
+    }
+    if (nodemap & b)
+      return children[index(nodemap, b)]->find(key, hash, shift + bits);
+    return nullptr;
+  }
+
+  // a node holding the two entries, at the level given by 'shift'
+  static std::shared_ptr<const Node> pair(Entry a, Entry b, unsigned shift) {
+    auto n = std::make_shared<Node>();
+    if (shift >= hash_bits) {
+      n->entries = {std::move(a), std::move(b)};
+      return n;
+    }
+    std::uint32_t ba = bit(a.hash, shift), bb = bit(b.hash, shift);
+    if (ba == bb) {
+      n->nodemap = ba;
+      n->children.push_back(pair(std::move(a), std::move(b), shift + bits));
+    } else {
+      n->datamap = ba | bb;
+      if (ba > bb)
+        std::swap(a, b);
+      n->entries = {std::move(a), std::move(b)};
+    }
+    return n;
+  }
+
+  // 'added' is set if the key wasn't there already
+  std::shared_ptr<const Node> insert(Entry e, unsigned shift,
+                                     bool& added) const {
+    auto n = std::make_shared<Node>(*this);
+    if (shift >= hash_bits) {
+      for (auto& x : n->entries)
+        if (same_value(x.key, e.key)) {
+          x.value = std::move(e.value);
+          return n;
+        }
+      n->entries.push_back(std::move(e));
+      added = true;
+      return n;
+    }
+    std::uint32_t b = bit(e.hash, shift);
+    if (datamap & b) {
+      auto i = index(datamap, b);
+      auto& x = n->entries[i];
+      if ((x.hash == e.hash) && same_value(x.key, e.key)) {
+        x.value = std::move(e.value);
+        return n;
+      }
+      // both go one level down
+      auto child = pair(std::move(x), std::move(e), shift + bits);
+      n->entries.erase(n->entries.begin() + i);
+      n->datamap &= ~b;
+      n->nodemap |= b;
+      n->children.insert(n->children.begin() + index(n->nodemap, b), child);
+      added = true;
+    } else if (nodemap & b) {
+      auto& c = n->children[index(nodemap, b)];
+      c = c->insert(std::move(e), shift + bits, added);
+    } else {
+      n->datamap |= b;
+      n->entries.insert(n->entries.begin() + index(n->datamap, b),
+                        std::move(e));
+      added = true;
+    }
+    return n;
+  }
+
+  // nullptr once the node is empty. 'removed' is set if the key was there.
+  std::shared_ptr<const Node> erase(const Symbol& key, std::size_t hash,
+                                    unsigned shift, bool& removed) const {
+    if (shift >= hash_bits) {
+      auto it = std::find_if(entries.begin(), entries.end(),
+                             [&](auto& x) { return same_value(x.key, key); });
+      if (it == entries.end())
+        return nullptr;
+      removed = true;
+      if (entries.size() == 1)
+        return nullptr;
+      auto n = std::make_shared<Node>(*this);
+      n->entries.erase(n->entries.begin() + (it - entries.begin()));
+      return n;
+    }
+    std::uint32_t b = bit(hash, shift);
+    if (datamap & b) {
+      auto i = index(datamap, b);
+      if ((entries[i].hash != hash) || !same_value(entries[i].key, key))
+        return nullptr;
+      removed = true;
+      if ((entries.size() == 1) && children.empty())
+        return nullptr;
+      auto n = std::make_shared<Node>(*this);
+      n->entries.erase(n->entries.begin() + i);
+      n->datamap &= ~b;
+      return n;
+    }
+    if (!(nodemap & b))
+      return nullptr;
+    auto j = index(nodemap, b);
+    auto c = children[j]->erase(key, hash, shift + bits, removed);
+    if (!removed)
+      return nullptr;
+    auto n = std::make_shared<Node>(*this);
+    if ((c == nullptr) || (c->children.empty() && (c->entries.size() == 1))) {
+      // a child left with one entry (or none) gives it back to this level,
+      // so the same keys always make the same tree
+      n->children.erase(n->children.begin() + j);
+      n->nodemap &= ~b;
+      if (c != nullptr) {
+        n->datamap |= b;
+        n->entries.insert(n->entries.begin() + index(n->datamap, b),
+                          c->entries.front());
+      }
+      if (n->entries.empty() && n->children.empty())
+        return nullptr;
+    } else
+      n->children[j] = c;
+    return n;
+  }
+};
+
+const Symbol* Map::find(const Symbol& key) const {
+  return root ? root->find(key, hash_value(key), 0) : nullptr;
+}
+
+Map Map::insert(const Symbol& key, const Symbol& value) const {
+  Node::Entry e{hash_value(key), key, value};
+  Map m;
+  bool added = false;
+  m.root = root ? root->insert(std::move(e), 0, added)
+                : Node{}.insert(std::move(e), 0, added);
+  m.count = count + added;
+  return m;
+}
+
+Map Map::erase(const Symbol& key) const {
+  if (!root)
+    return *this;
+  bool removed = false;
+  auto r = root->erase(key, hash_value(key), 0, removed);
+  if (!removed)
+    return *this;
+  Map m;
+  m.root = r;
+  m.count = count - 1;
+  return m;
+}
+
+template <class F>
+void Map::for_each(F f) const {
+  if (root)
+    root->for_each(f);
+}
+
+bool Map::operator==(const Map& other) const {
+  if (root == other.root)
+    return true;
+  if (count != other.count)
+    return false;
+  bool same = true;
+  for_each([&](const Symbol& k, const Symbol& v) {
+    auto x = same ? other.find(k) : nullptr;
+    same = x && same_value(*x, v);
+  });
+  return same;
+}
+
+// the map of a '{k1 v1 k2 v2 ...} literal, from its evaluated elements. A
+// key given twice keeps the last of its values.
+template <class It>
+Symbol make_map(It first, It last) {
+  Map m;
+  for (; (first != last) && (first + 1 != last); first += 2)
+    m = m.insert(*first, *(first + 1));
+  return Symbol(m, Type::Map);
+}
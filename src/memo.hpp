@@ -0,0 +1,98 @@
+#pragma once
+// Copyright 2023 Sofia Cerasuoli (@SwitchAxe)
+/*
+  This file is part of Rewind.
+  Rewind is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation, either version 3 of the license, or (at your
+  option) any later version.
+  Rewind is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Rewind. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "map.hpp"
+#include "types.hpp"
+#include <cstddef>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+// The results of a memoized function (see 'memo' in builtins/misc.hpp),
+// keyed on its arguments, compared with same_value() (see map.hpp).
+// With a capacity, the least recently used entry makes room for a new one.
+// The parallel builtins can call the same function from several threads,
+// hence the lock.
+
+struct MemoStats {
+  std::size_t hits = 0;
+  std::size_t misses = 0;
+  std::size_t evictions = 0;
+  std::size_t size = 0;
+};
+
+class MemoTable {
+public:
+  // a capacity of 0 is unbounded
+  explicit MemoTable(std::size_t _capacity) : capacity(_capacity) {}
+
+  std::optional<Symbol> find(const List& args) {
+    std::lock_guard lock(m);
+    auto it = index.find(args);
+    if (it == index.end()) {
+      counters.misses++;
+      return std::nullopt;
+    }
+    counters.hits++;
+    lru.splice(lru.begin(), lru, it->second);
+    return it->second->result;
+  }
+
+  void insert(const List& args, const Symbol& result) {
+    std::lock_guard lock(m);
+    if (index.contains(args))
+      return; // a recursive call got there first
+    if ((capacity != 0) && (lru.size() == capacity)) {
+      index.erase(lru.back().args);
+      lru.pop_back();
+      counters.evictions++;
+    }
+    // a buffer of its own, which no one appends to in place
+    lru.push_front(Entry{List(args.begin(), args.end()), result});
+    index.emplace(lru.front().args, lru.begin());
+  }
+
+  // as given to the constructor
+  std::size_t max_size() const { return capacity; }
+
+  MemoStats stats() {
+    std::lock_guard lock(m);
+    MemoStats st = counters;
+    st.size = lru.size();
+    return st;
+  }
+
+private:
+  struct Entry {
+    List args;
+    Symbol result;
+  };
+  struct Hash {
+    std::size_t operator()(const List& l) const { return hash_values(l); }
+  };
+  struct Equal {
+    bool operator()(const List& a, const List& b) const {
+      return same_values(a, b);
+    }
+  };
+
+  std::mutex m;
+  std::size_t capacity;
+  std::list<Entry> lru; // the most recently used first
+  std::unordered_map<List, std::list<Entry>::iterator, Hash, Equal> index;
+  MemoStats counters;
+};
@@ -15,28 +15,45 @@
   Rewind. If not, see <https://www.gnu.org/licenses/>.
 */
 #include "lexer.hpp"
+#include "map.hpp"
 #include "types.hpp"
 #include <charconv>
 #include <iostream>
 #include <stack>
 #include <type_traits>
 #include <optional>
+#include <span>
 
 
-std::string rec_print_ast(Symbol root, bool debug = false);
+std::string rec_print_ast(const Symbol& root, bool debug = false);
+std::shared_ptr<const Chunk> compile_function(const Symbol& fn);
 
-bool is_strlit(std::string s) {
+bool is_strlit(std::string_view s) {
   return (s.size() > 1) && (((s[0] == '\'') && (s.back() == '\'')) ||
                             ((s[0] == '"') && (s.back() == '"')));
 }
 
-std::optional<long long signed int> try_convert_num(std::string n) {
+std::optional<BigInt> try_convert_num(std::string_view n) {
   long long int v;
   auto [ptr, ec] = std::from_chars(n.data(), n.data() + n.size(), v);
-  if (ptr == n.data() + n.size()) {
-    return v;
-  }
-  return std::nullopt;
+  if (ptr != n.data() + n.size())
+    return std::nullopt;
+  if (ec == std::errc::result_out_of_range)
+    return BigInt::parse(n);
+  return v;
+}
+
+// a decimal with a '.' in it, like 1.5 or -0.25. Anything else (such as
+// "inf" or "1e5") is an identifier.
+std::optional<double> try_convert_double(std::string_view n) {
+  if (n.find('.') == std::string_view::npos)
+    return std::nullopt;
+  double v;
+  auto [ptr, ec] = std::from_chars(n.data(), n.data() + n.size(), v,
+                                   std::chars_format::fixed);
+  if ((ec != std::errc()) || (ptr != n.data() + n.size()))
+    return std::nullopt;
+  return v;
 }
 
 // information we need to keep track of in get_ast_aux
@@ -48,41 +65,61 @@ struct RecInfo {
 
 std::string format_line(int l) { return "(line " + std::to_string(l) + ")"; }
 
-RecInfo dispatch_parse(std::vector<Token> tokens, int si);
+RecInfo dispatch_parse(std::span<const Token> tokens, int si);
+
+// throws unless there's a token at i, when the program ends in the middle
+// of something
+void expect_token(std::span<const Token> tokens, int i, std::string_view what) {
+  if (i < int(tokens.size()))
+    return;
+  throw std::logic_error {format_line(tokens.empty() ? 0 : tokens.back().line) +
+                          " Unexpected end of the program, expected " +
+                          std::string{what} + "!\n"};
+}
+
+Symbol parse_identifier(std::string_view tk, int line = 0) {
+  Symbol ret = Symbol(std::string{tk}, Type::Identifier);
+  ret.line = line;
+  return ret;
+}
 
-Symbol parse_identifier(std::string tk, int line = 0) {
-  Symbol ret = Symbol("", tk, Type::Identifier);
+Symbol parse_number(BigInt n, int line = 0) {
+  Symbol ret = make_number(std::move(n));
   ret.line = line;
   return ret;
 }
 
-Symbol parse_number(signed long long int n, int line = 0) {
-  Symbol ret = Symbol("", n, Type::Number);
+Symbol parse_number(double n, int line = 0) {
+  Symbol ret = Symbol(n, Type::Number);
   ret.line = line;
   return ret;
 }
 
-Symbol parse_strlit(std::string tk, int line = 0) {
-  Symbol ret = Symbol("", tk.substr(1, tk.size() - 2), Type::String);
+// the escapes are only processed in double quotes
+Symbol parse_strlit(std::string_view tk, int line = 0) {
+  auto s = tk.substr(1, tk.size() - 2);
+  Symbol ret = Symbol((tk[0] == '"') ? process_escapes(s) : std::string{s},
+                      Type::String);
   ret.line = line;
   return ret;
 }
 
-Symbol parse_bool(std::string tk, int line = 0) {
-  Symbol ret = Symbol("", tk == "true" ? true : false, Type::Boolean);
+Symbol parse_bool(std::string_view tk, int line = 0) {
+  Symbol ret = Symbol(tk == "true" ? true : false, Type::Boolean);
   ret.line = line;
   return ret;
 }
 
-RecInfo parse_list_expr(std::vector<Token> tokens, int si);
-RecInfo parse_list(std::vector<Token> tks, int i);
+RecInfo parse_list_expr(std::span<const Token> tokens, int si);
+RecInfo parse_list(std::span<const Token> tks, int i);
+RecInfo parse_map_literal(std::span<const Token> tokens, int si);
 
-RecInfo parse_list_literal(std::vector<Token> tokens, int si) {
+RecInfo parse_list_literal(std::span<const Token> tokens, int si) {
   // parses a (possibly recursive) list from start to finish, and then
   // returns.
-  std::list<Symbol> ret;
+  List ret;
   int i = 0;
-  for (i = si+1; i < tokens.size(); ++i) {
+  for (i = si+1; i < int(tokens.size()); ++i) {
     auto tok = tokens[i];
     auto tk = tok.tk;
     if ((tk == "(") || (tk == "[")) {
@@ -90,8 +127,8 @@ RecInfo parse_list_literal(std::vector<Token> tokens, int si) {
       got.result.line = tok.line;
       ret.push_back(got.result);
       i = got.end_index;
-    } else if ((tk == ")") || (tk == "]")) {
-      Symbol r = Symbol("", ret, Type::ListLiteral);
+    } else if ((tk == ")") || (tk == "]") || (tk == "}")) {
+      Symbol r = Symbol(ret, Type::ListLiteral);
       r.line = tok.line;
       return RecInfo {
 	      .result = r,
@@ -102,27 +139,42 @@ RecInfo parse_list_literal(std::vector<Token> tokens, int si) {
       got.result.line = tok.line;
       ret.push_back(got.result);
       i = got.end_index;
+    } else if (tk == "'{") {
+      auto got = parse_map_literal(tokens, i);
+      got.result.line = tok.line;
+      ret.push_back(got.result);
+      i = got.end_index;
     } else {
-      auto got = dispatch_parse(std::vector<Token>{tokens[i]}, 0);
+      auto got = dispatch_parse(tokens.subspan(i, 1), 0);
       ret.push_back(got.result);
     }
   }
   throw std::logic_error {format_line(tokens[i-1].line) +
 			  " Unclosed list!\n"};
 }
+
+// '{k1 v1 k2 v2 ...}: the keys and values are parsed like the elements of a
+// list literal, and taken two by two once evaluated.
+RecInfo parse_map_literal(std::span<const Token> tokens, int si) {
+  auto got = parse_list_literal(tokens, si);
+  if (std::get<List>(got.result.value).size() % 2 != 0)
+    throw std::logic_error {format_line(got.line) +
+			    " A map literal needs a value for every key!\n"};
+  got.result.type = Type::MapLiteral;
+  return got;
+}
 RecInfo literal_to_expr(RecInfo got);
-RecInfo parse_list_expr(std::vector<Token> tokens, int si) {
+RecInfo parse_list_expr(std::span<const Token> tokens, int si) {
   auto got = parse_list_literal(tokens, si);
   return literal_to_expr(got);
 }
 
-RecInfo parse_block_function(std::vector<Token> tokens, int si) {
-  std::list<Symbol> body;
-  int i = 0;
-  for (int i = si + 1; i < tokens.size(); ++i) {
+RecInfo parse_block_function(std::span<const Token> tokens, int si) {
+  List body;
+  for (int i = si + 1; i < int(tokens.size()); ++i) {
     auto tk = tokens[i];
     if (tk.tk == "}") {
-      Symbol block = Symbol("", body, Type::List);
+      Symbol block = Symbol(body, Type::List);
       block.is_block = true;
       block.line = tk.line;
       return RecInfo {
@@ -135,21 +187,21 @@ RecInfo parse_block_function(std::vector<Token> tokens, int si) {
     body.push_back(got.result);
     i = got.end_index;
   }
-  throw std::logic_error {format_line(tokens[si-1].line) +
+  throw std::logic_error {format_line(tokens[si].line) +
 			  " Unclosed '}' in a function definition!\n"};
 }
 
-RecInfo parse_function_call(std::vector<Token> tokens, int si) {
-  std::list<Symbol> fcall;
+RecInfo parse_function_call(std::span<const Token> tokens, int si) {
+  List fcall;
 
   if (tokens.size() == 1) {
-    fcall.push_back(Symbol("", tokens[si].tk, Type::Operator));
-    auto sym = Symbol("", fcall, Type::List);
+    fcall.push_back(Symbol(std::string{tokens[si].tk}, Type::Operator));
+    auto sym = Symbol(fcall, Type::List);
     sym.line = tokens[si].line;
     return RecInfo {.result = sym, .end_index = si, .line = tokens[si].line};
   }
   int i = 0;
-  for (i = si; i < tokens.size(); ++i) {
+  for (i = si; i < int(tokens.size()); ++i) {
     Token tk = tokens[i];
     if (tk.tk == ";") {
       if (fcall.size() > 0) {
@@ -160,7 +212,7 @@ RecInfo parse_function_call(std::vector<Token> tokens, int si) {
 	      fcall.push_front(op);
       }
       return RecInfo {
-	      .result = Symbol("", fcall, Type::List),
+	      .result = Symbol(fcall, Type::List),
 	      .end_index = i,
 	      .line = tk.line };
     }
@@ -175,13 +227,18 @@ RecInfo parse_function_call(std::vector<Token> tokens, int si) {
       got.result.line = tk.line;
       fcall.push_back(got.result);
       i = got.end_index;
+    } else if (tk.tk == "'{") {
+      auto got = parse_map_literal(tokens, i);
+      got.result.line = tk.line;
+      fcall.push_back(got.result);
+      i = got.end_index;
     } else {
-      auto got = dispatch_parse(std::vector<Token>{tk}, 0);
+      auto got = dispatch_parse(tokens.subspan(i, 1), 0);
       got.result.line = tk.line;
       fcall.push_back(got.result);
     }
   }
-  if (i == tokens.size()) {
+  if (i == int(tokens.size())) {
     if (fcall.size() > 0) {
       auto op = fcall.front();
       fcall.pop_front();
@@ -190,7 +247,7 @@ RecInfo parse_function_call(std::vector<Token> tokens, int si) {
       fcall.push_front(op);
     }
     return RecInfo {
-      .result = Symbol("", fcall, Type::List),
+      .result = Symbol(fcall, Type::List),
       .end_index = i,
       .line = tokens.back().line };
   }
@@ -198,7 +255,8 @@ RecInfo parse_function_call(std::vector<Token> tokens, int si) {
 			  " Missing semicolon ';' after a function call!\n"};
 }
 
-RecInfo parse_function_body(std::vector<Token> tokens, int si) {
+RecInfo parse_function_body(std::span<const Token> tokens, int si) {
+  expect_token(tokens, si, "the body of a function");
   if (tokens[si].tk == "{") {
     // block function
     return parse_block_function(tokens, si);
@@ -206,19 +264,20 @@ RecInfo parse_function_body(std::vector<Token> tokens, int si) {
   auto got = dispatch_parse(tokens, si);
   // wrap it inside a list to match the block functions
   return RecInfo {
-    .result = Symbol("", std::list<Symbol>{got.result}, Type::List),
+    .result = Symbol(List{got.result}, Type::List),
     .end_index = got.end_index,
     .line = got.line
   };
 }
 
-RecInfo parse_function(std::vector<Token> tokens, int si) {
-  // (args...) => statements...
-  std::list<Symbol> f;
-  RecInfo args = parse_list_literal(tokens, si);
-  si = args.end_index + 1;
-  auto l = std::get<std::list<Symbol>>(args.result.value);
-  f.push_back(Symbol("", l, Type::List));
+// (args...) => statements..., where 'args' is the parameter list, already
+// parsed as a list literal
+RecInfo parse_function(std::span<const Token> tokens, const RecInfo& args) {
+  List f;
+  int si = args.end_index + 1;
+  auto l = std::get<List>(args.result.value);
+  f.push_back(Symbol(l, Type::List));
+  expect_token(tokens, si, "'=>' after the parameter list");
   if (tokens[si].tk != "=>")
     throw std::logic_error {format_line(tokens[si].line) +
 			    " Invalid syntax for a function definition:\n"
@@ -228,8 +287,9 @@ RecInfo parse_function(std::vector<Token> tokens, int si) {
   auto v = body.result;
   si = body.end_index;
   f.push_back(v);
-  auto fun = Symbol("", f, Type::Function);
+  auto fun = Symbol(f, Type::Function);
   fun.line = body.line;
+  fun.code = compile_function(fun);
   return RecInfo {
     .result = fun,
     .end_index = si,
@@ -238,7 +298,7 @@ RecInfo parse_function(std::vector<Token> tokens, int si) {
 }
 
 RecInfo literal_to_expr(RecInfo got) {
-  auto l = std::get<std::list<Symbol>>(got.result.value);
+  auto l = std::get<List>(got.result.value);
   if (l.empty())
     throw std::logic_error {format_line(got.line) +
 			    " Empty function call!\n"};
@@ -255,39 +315,41 @@ RecInfo literal_to_expr(RecInfo got) {
 
 // this parses either a list expression or a function definition, depending on
 // what comes after the list
-RecInfo parse_list(std::vector<Token> tks, int i) {
+RecInfo parse_list(std::span<const Token> tks, int i) {
   auto got = parse_list_literal(tks, i);
   auto idx = got.end_index;
-  if (tks[idx+1].tk == "=>") {
+  if ((idx + 1 < int(tks.size())) && (tks[idx+1].tk == "=>")) {
     // a function.
-    return parse_function(tks, i);
+    return parse_function(tks, got);
   }
   // otherwise, we just parsed a list expression:
   return literal_to_expr(got);
 }
 
-RecInfo parse_let(std::vector<Token> tokens, int si) {
+RecInfo parse_let(std::span<const Token> tokens, int si) {
   // let <name> = <any value, also functions>
   auto orig = si;
   si++; // skip the "let" keyword
+  expect_token(tokens, si, "a name after 'let'");
   Symbol name = parse_identifier(tokens[si].tk);
   si++;
+  expect_token(tokens, si, "'=' in a let-binding");
   if (tokens[si].tk != "=")
     throw std::logic_error {format_line(tokens[si].line) +
 			   + " Missing '=' in a let-binding!\n"};
   si++;
   RecInfo any_v = dispatch_parse(tokens, si);
   if (any_v.end_index == si)
-    if (tokens[si+1].tk != ";")
+    if ((si + 1 >= int(tokens.size())) || (tokens[si+1].tk != ";"))
       throw std::logic_error {"Missing semicolon at the end of a let-binding!\n"};
     else si++;
   else si = any_v.end_index;
-  std::list<Symbol> ret = {
-    Symbol("", "let", Type::Operator),
+  List ret = {
+    Symbol("let", Type::Operator),
     name,
     any_v.result
   };
-  Symbol rets = Symbol("", ret, Type::List);
+  Symbol rets = Symbol(ret, Type::List);
   rets.line = tokens[orig].line;
   return RecInfo {
     .result = rets,
@@ -295,19 +357,58 @@ RecInfo parse_let(std::vector<Token> tokens, int si) {
     .line = tokens[si].line };
 }
 
-RecInfo parse_branch_section(std::vector<Token> tokens, int i, bool expr = false) {
+// the index of the last token of 'let <name> = (<params>) => <body>' at
+// tokens[si], found by matching the brackets instead of parsing it. -1
+// unless the body is a block or a list expression, since only those end
+// on their closing bracket.
+int skim_function_let(std::span<const Token> tokens, int si) {
+  auto closing = [&](int i) {
+    int depth = 0;
+    for (; i < int(tokens.size()); ++i) {
+      auto tk = tokens[i].tk;
+      if ((tk == "(") || (tk == "[") || (tk == "{") || (tk == "'(") ||
+          (tk == "'[") || (tk == "'{"))
+        depth++;
+      else if (((tk == ")") || (tk == "]") || (tk == "}")) && (--depth == 0))
+        return i;
+    }
+    return -1;
+  };
+  if ((si + 5 >= int(tokens.size())) || (tokens[si].tk != "let") ||
+      (tokens[si + 2].tk != "=") ||
+      ((tokens[si + 3].tk != "(") && (tokens[si + 3].tk != "[")))
+    return -1;
+  int end = closing(si + 3);
+  if ((end < 0) || (end + 2 >= int(tokens.size())) ||
+      (tokens[end + 1].tk != "=>"))
+    return -1;
+  auto body = tokens[end + 2].tk;
+  if ((body != "{") && (body != "(") && (body != "["))
+    return -1;
+  end = closing(end + 2);
+  // (x) => (y) => ... goes on after the list
+  if ((end < 0) || ((body != "{") && (end + 1 < int(tokens.size())) &&
+                    (tokens[end + 1].tk == "=>")))
+    return -1;
+  return end;
+}
+
+RecInfo parse_branch_section(std::span<const Token> tokens, int i, bool expr = false) {
   RecInfo part;
+  expect_token(tokens, i, "a branch");
   if ((tokens[i].tk == "(") || (tokens[i].tk == "[")) {
     part = parse_list_expr(tokens, i);
     if (expr)
-      part.result = Symbol("", std::list<Symbol>{part.result}, Type::List);
+      part.result = Symbol(List{part.result}, Type::List);
     part.end_index++;
     part.result.line = tokens[i].line;
   }
-  else if ((tokens[i].tk == "'(") || (tokens[i].tk == "'[")) {
-    part = parse_list_literal(tokens, i);
+  else if ((tokens[i].tk == "'(") || (tokens[i].tk == "'[") ||
+           (tokens[i].tk == "'{")) {
+    part = (tokens[i].tk == "'{") ? parse_map_literal(tokens, i)
+                                  : parse_list_literal(tokens, i);
     if (expr)
-      part.result = Symbol("", std::list<Symbol>{part.result}, Type::List);
+      part.result = Symbol(List{part.result}, Type::List);
     part.end_index++;
     part.result.line = tokens[i].line;
   } else if (tokens[i].tk == "{") {
@@ -317,9 +418,10 @@ RecInfo parse_branch_section(std::vector<Token> tokens, int i, bool expr = false
   }
   else {
     // if it's not a list, we assume that it's not a function call!
-    part = dispatch_parse(std::vector<Token>{tokens[i]}, 0);
+    part = dispatch_parse(tokens.subspan(i, 1), 0);
     i++;
     part.end_index = i;
+    expect_token(tokens, i, expr ? "',' or ';' after a branch" : "'=>'");
     part.result.line = tokens[i].line;
     if (expr)
       if ((tokens[i].tk != ",") && (tokens[i].tk != ";"))
@@ -329,13 +431,14 @@ RecInfo parse_branch_section(std::vector<Token> tokens, int i, bool expr = false
   return part;
 }
 
-RecInfo parse_branch(std::vector<Token> tokens, int i) {
-  std::list<Symbol> l = {};
+RecInfo parse_branch(std::span<const Token> tokens, int i) {
+  List l = {};
   auto orig = i;
   i++; // skip the "|"
 
   RecInfo cond = parse_branch_section(tokens, i);
   i = cond.end_index;
+  expect_token(tokens, i, "'=>' in a branch");
   if (tokens[i].tk != "=>")
     throw std::logic_error {format_line(tokens[i].line) +
 			    "Missing '=>' token in a branch!\n"};
@@ -344,11 +447,11 @@ RecInfo parse_branch(std::vector<Token> tokens, int i) {
   i = body.end_index;
   l = {cond.result};
   if (body.result.type == Type::List) {
-    for (auto x : std::get<std::list<Symbol>>(body.result.value))
+    for (auto x : std::get<List>(body.result.value))
       l.push_back(x);
   }
   else l = {cond.result, body.result};
-  auto ret = Symbol("", l, Type::List);
+  auto ret = Symbol(l, Type::List);
   ret.line = tokens[orig].line;
   return RecInfo {
     .result = ret,
@@ -357,14 +460,14 @@ RecInfo parse_branch(std::vector<Token> tokens, int i) {
   };
 }
 
-RecInfo parse_match(std::vector<Token> tokens, int i) {
+RecInfo parse_match(std::span<const Token> tokens, int i) {
   // we parse a value, and branches afterwards.
   i++; // skip the "match" keyword
   auto orig = i;
   RecInfo matched = parse_branch_section(tokens, i);
   i = matched.end_index - 1;
-  std::list<Symbol> l = {
-    Symbol("", "match", Type::Operator),
+  List l = {
+    Symbol("match", Type::Operator),
     matched.result
   };
   RecInfo got;
@@ -372,8 +475,9 @@ RecInfo parse_match(std::vector<Token> tokens, int i) {
     got = parse_branch(tokens, i + 1);
     i = got.end_index;
     l.push_back(got.result);
+    expect_token(tokens, i, "';' after the last branch");
   } while (tokens[i].tk != ";");
-  Symbol ret = Symbol("", l, Type::List);
+  Symbol ret = Symbol(l, Type::List);
   ret.line = tokens[orig].line;
   return RecInfo {
     .result = ret,
@@ -382,16 +486,17 @@ RecInfo parse_match(std::vector<Token> tokens, int i) {
   };
 }
 
-RecInfo parse_cond(std::vector<Token> tokens, int i) {
-  auto l = std::list<Symbol>{Symbol("", "cond", Type::Operator)};
+RecInfo parse_cond(std::span<const Token> tokens, int i) {
+  auto l = List{Symbol("cond", Type::Operator)};
   RecInfo got;
   auto orig = i;
   do {
     got = parse_branch(tokens, i + 1);
     i = got.end_index;
     l.push_back(got.result);
+    expect_token(tokens, i, "';' after the last branch");
   } while (tokens[i].tk != ";");
-  auto ret = Symbol("", l, Type::List);
+  auto ret = Symbol(l, Type::List);
   ret.line = tokens[orig].line;
   return RecInfo {
     .result = ret,
@@ -400,12 +505,18 @@ RecInfo parse_cond(std::vector<Token> tokens, int i) {
   };
 }
 
-RecInfo dispatch_parse(std::vector<Token> tks, int i) {
+RecInfo dispatch_parse(std::span<const Token> tks, int i) {
+  expect_token(tks, i, "an expression");
   if (auto n = try_convert_num(tks[i].tk); n != std::nullopt)
     return RecInfo {
       .result = parse_number(*n),
       .end_index = i,
       .line = tks[i].line };
+  if (auto n = try_convert_double(tks[i].tk); n != std::nullopt)
+    return RecInfo {
+      .result = parse_number(*n),
+      .end_index = i,
+      .line = tks[i].line };
   if (is_strlit(tks[i].tk))
     return RecInfo {
       .result = parse_strlit(tks[i].tk),
@@ -430,6 +541,8 @@ RecInfo dispatch_parse(std::vector<Token> tks, int i) {
   if ((tks[i].tk == "'(") || (tks[i].tk == "'[")) {
     return parse_list_literal(tks, i);
   }
+  if (tks[i].tk == "'{")
+    return parse_map_literal(tks, i);
   if (tks[i].tk == "let")
     return parse_let(tks, i);
   if (tks[i].tk == "match")
@@ -451,42 +564,58 @@ RecInfo dispatch_parse(std::vector<Token> tks, int i) {
 // trees, so they have the global flag set.
 // the Symbol returned by this procedure can be
 // evaluated directly.
-Symbol parse(std::vector<Token> tokens) {
+Symbol parse(std::span<const Token> tokens) {
   RecInfo cur;
   int i = 0;
-  std::list<Symbol> program;
+  List program;
   do {
     cur = dispatch_parse(tokens, i);
     cur.result.is_global = true;
     i = cur.end_index + 1;
     program.push_back(cur.result);
-  } while (i < tokens.size());
-  return Symbol("", program, Type::List);
+  } while (i < int(tokens.size()));
+  return Symbol(program, Type::List);
+}
+
+// the program of a whole source, which can be empty or only comments
+Symbol parse_source(std::string_view source) {
+  auto tokens = get_tokens(source);
+  return tokens.empty() ? Symbol(List{}, Type::List) : parse(tokens);
 }
 
 // DEBUG PURPOSES ONLY and for printing the final result until i
 // make an iterative version of this thing
 
-std::string rec_print_ast(Symbol root, bool debug) {
+std::string rec_print_ast(const Symbol& root, bool debug) {
   std::string res;
-  if (std::holds_alternative<std::list<Symbol>>(root.value)) {
+  if (std::holds_alternative<List>(root.value)) {
     if (debug)
       res += std::string{(root.type == Type::RawAst) ? "(Ast)" : "(List) "} +
              " [ ";
     else
       res += "[ ";
-    for (auto s : std::get<std::list<Symbol>>(root.value)) {
+    for (const auto& s : std::get<List>(root.value)) {
       res += rec_print_ast(s, debug) + " ";
     }
     res += "]";
+  } else if (auto m = std::get_if<Map>(&root.value)) {
+    res += debug ? "(Map) { " : "{ ";
+    m->for_each([&](const Symbol& k, const Symbol& v) {
+      res += rec_print_ast(k, debug) + " " + rec_print_ast(v, debug) + " ";
+    });
+    res += "}";
   } else {
     std::visit(overloaded{
       [&](std::monostate) -> void {},
       [&](std::string s) -> void {
 	res = debug ? "(Str) " + s : s;
       },
-      [&](unsigned long long int n) -> void {
-	auto s = std::to_string(n);
+      [&](const BigInt& n) -> void {
+	auto s = n.to_string();
+	res = debug ? "(Num) " + s : s;
+      },
+      [&](double n) -> void {
+	auto s = format_double(n);
 	res = debug ? "(Num) " + s : s;
       },
       [&](signed long long int n) -> void {
@@ -0,0 +1,144 @@
+#pragma once
+// Copyright 2023 Sofia Cerasuoli (@SwitchAxe)
+/*
+  This file is part of Rewind.
+  Rewind is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation, either version 3 of the license, or (at your
+  option) any later version.
+  Rewind is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Rewind. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "types.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <latch>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// The worker threads of the parallel builtins (see builtins/parallel.hpp),
+// one per core. Every worker has a queue of its own: it takes its tasks
+// from the back of it, and once it's empty, steals from the front of the
+// others'. The thread running a batch only waits for it, so while a batch
+// runs, the values it handed out are only read, never written to.
+class ThreadPool {
+public:
+  using Task = std::function<void()>;
+
+  static ThreadPool& get() {
+    static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+    return pool;
+  }
+
+  explicit ThreadPool(unsigned n) {
+    for (unsigned i = 0; i < n; ++i)
+      queues.push_back(std::make_unique<Queue>());
+    for (unsigned i = 0; i < n; ++i)
+      threads.emplace_back([this, i] { work(i); });
+  }
+  ~ThreadPool() {
+    {
+      std::lock_guard lock(m);
+      stop = true;
+    }
+    wake.notify_all();
+    for (auto& t : threads)
+      t.join();
+  }
+
+  std::size_t size() const { return threads.size(); }
+
+  // true on the worker threads, where a batch can't wait for other tasks
+  static bool on_worker() { return worker; }
+
+  // runs the tasks and returns once they're all done. The first exception
+  // a task throws (in the order of 'tasks') is thrown again here.
+  void run(const std::vector<Task>& tasks) {
+    std::vector<std::exception_ptr> errors(tasks.size());
+    std::latch done(tasks.size());
+    for (std::size_t i = 0; i < tasks.size(); ++i) {
+      Task t = [&, i] {
+        // every task builds its lists apart from the others', see Seq
+        list_owner = next_list_owner();
+        try {
+          tasks[i]();
+        } catch (...) {
+          errors[i] = std::current_exception();
+        }
+        done.count_down();
+      };
+      auto& q = *queues[i % queues.size()];
+      std::lock_guard lock(q.m);
+      q.tasks.push_back(std::move(t));
+    }
+    {
+      std::lock_guard lock(m);
+      pending += tasks.size();
+    }
+    wake.notify_all();
+    done.wait();
+    for (auto& e : errors)
+      if (e)
+        std::rethrow_exception(e);
+  }
+
+private:
+  struct Queue {
+    std::mutex m;
+    std::deque<Task> tasks;
+  };
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> threads;
+  std::mutex m; // guards 'pending' and 'stop', idle workers wait on 'wake'
+  std::condition_variable wake;
+  std::size_t pending = 0; // tasks queued and not taken yet
+  bool stop = false;
+  static inline thread_local bool worker = false;
+
+  bool take(std::size_t i, Task& t) {
+    for (std::size_t k = 0; k < queues.size(); ++k) {
+      auto& q = *queues[(i + k) % queues.size()];
+      std::lock_guard lock(q.m);
+      if (q.tasks.empty())
+        continue;
+      if (k == 0) {
+        t = std::move(q.tasks.back());
+        q.tasks.pop_back();
+      } else {
+        t = std::move(q.tasks.front());
+        q.tasks.pop_front();
+      }
+      std::lock_guard l(m);
+      pending--;
+      return true;
+    }
+    return false;
+  }
+
+  void work(std::size_t i) {
+    worker = true;
+    for (;;) {
+      Task t;
+      if (take(i, t)) {
+        t();
+        continue;
+      }
+      std::unique_lock lock(m);
+      wake.wait(lock, [this] { return stop || (pending > 0); });
+      if (stop)
+        return;
+    }
+  }
+};
@@ -27,17 +27,21 @@
 #include <iostream>
 #include <iterator>
 #include <map>
+#include <memory>
 #include <optional>
 #include <ostream>
 #include <stdexcept>
 #include <stdio.h>
 #include <string.h>
 #include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <termios.h>
 #include <type_traits>
 #include <unistd.h>
 #include <utility>
+#include <vector>
 #include <variant>
 struct PidSym {
   Symbol s;
@@ -45,28 +49,124 @@ struct PidSym {
 };
 
 
-std::string rec_print_ast(Symbol root, bool debug);
-RecInfo parse(std::vector<Token> tokens, int i);
-std::string rewind_read_file(std::string filename);
+std::string rec_print_ast(const Symbol& root, bool debug);
 std::vector<std::pair<int, std::string>> rewind_split_file(std::string content);
-variables constants;
-std::vector<int> active_pids;
-// this is used to pass single-use environment variables to external programs.
-// if this vector contains more than *number of elements in a pipe* or more than
-// 1 for a single program call, it's most likely an error.
-std::vector<std::map<std::string, std::string>> environment_variables;
+
+// A call frame. The parameters of a function are resolved to slots when
+// it's compiled (see Chunk::params), so a frame is just their ids and the
+// arguments, both indexed by slot. The frames of calls running on the VM
+// point at its registers instead of holding a copy of the arguments.
+struct Frame {
+  SymbolId function = no_symbol;
+  std::shared_ptr<const std::vector<SymbolId>> params{};
+  std::vector<Symbol> args{}; // the slots, unless 'regs' is set
+  std::vector<Symbol> *regs = nullptr;
+  std::size_t base = 0; // slot i is (*regs)[base + i]
+
+  const Symbol *slot(SymbolId id) const {
+    if (params == nullptr)
+      return nullptr;
+    for (std::size_t i = 0; i < params->size(); ++i)
+      if ((*params)[i] == id)
+        return regs ? &(*regs)[base + i] : &args[i];
+    return nullptr;
+  }
+};
+
+// a stamp for Interpreter::binding_version. They are unique in the whole
+// process: a function can be shared by two interpreters, and the call
+// caches of its chunk must never match in the one that didn't fill them.
+std::uint64_t next_binding_version() {
+  static std::atomic<std::uint64_t> last{0};
+  return ++last;
+}
+
+// The state of an evaluation: the globals, the call stack, and the
+// programs it started. The thread running an interpreter makes it its
+// current one with Interpreter::Use, and the evaluator reaches it through
+// interp(), so interpreters running on separate threads share nothing but
+// the interned names (see intern.hpp).
+class Interpreter {
+public:
+  Interpreter() = default;
+  // an interpreter for a worker of the parallel builtins: it sees the
+  // globals of 'parent', while what it binds stays its own.
+  explicit Interpreter(Interpreter &parent)
+      : constants(&parent.constants), reference_mode(parent.reference_mode),
+        parent(&parent) {}
+  Interpreter(const Interpreter &) = delete;
+  Interpreter &operator=(const Interpreter &) = delete;
+
+  variables constants;
+  std::vector<Frame> call_stack;
+  std::vector<int> active_pids;
+  // this is used to pass single-use environment variables to external
+  // programs. if this vector contains more than *number of elements in a
+  // pipe* or more than 1 for a single program call, it's most likely an
+  // error.
+  std::vector<std::map<std::string, std::string>> environment_variables;
+  std::map<std::string, Symbol> cmdline_args;
+  std::vector<std::map<std::string, std::pair<Symbol, Symbol>>>
+      user_defined_procedures;
+  // bumped every time a function is bound anywhere, which is the only way
+  // a name can start resolving to something else (bindings are never
+  // replaced). The call sites of compiled code cache their callee along
+  // with this stamp, see CallCache in compiler.hpp.
+  std::uint64_t binding_version = next_binding_version();
+  // set by '--reference': evaluate everything on the tree-walker in
+  // evaluator.hpp instead of compiling it for the VM in vm.hpp.
+  bool reference_mode = false;
+
+  // makes a function of the host program callable from Rewind code like
+  // the builtins, see procedure() in builtins/include.hpp.
+  void define_builtin(std::string_view name, Builtin::native_type fn,
+                      int arity = Builtin::variadic);
+  // nullptr unless the host program defined a builtin with that name
+  const Builtin *host_builtin(SymbolId id) const {
+    for (auto i = this; i != nullptr; i = i->parent)
+      if (auto it = i->host_builtins.find(id); it != i->host_builtins.end())
+        return &it->second.entry;
+    return nullptr;
+  }
+
+  // the interpreter is the current one of this thread while this lives
+  class Use {
+  public:
+    explicit Use(Interpreter &i) : previous(current) { current = &i; }
+    ~Use() { current = previous; }
+    Use(const Use &) = delete;
+    Use &operator=(const Use &) = delete;
+
+  private:
+    Interpreter *previous;
+  };
+
+private:
+  struct HostBuiltin {
+    Builtin::native_type fn;
+    Builtin entry; // calls 'fn'
+  };
+
+  Interpreter *parent = nullptr;
+  // the nodes of an unordered_map stay put, so the pointers to the entries
+  // (and theirs to 'fn') stay valid.
+  std::unordered_map<SymbolId, HostBuiltin> host_builtins;
+  static inline thread_local Interpreter *current = nullptr;
+  friend Interpreter &interp();
+};
+
+Interpreter &interp() { return *Interpreter::current; }
+
+void function_bound() {
+  interp().binding_version = next_binding_version();
+}
+
 // These two functions are used to get an integer, or 0, from a variant,
 // depending on if the variant contains an integer (see the concept in
 // types.hpp) or another type. The return value of the second function is not a
 // problem, since we're only gonna call them when we are certain we're gonna get
 // an integer anyway.
 
-template <class K, class V>
-std::map<K, V> combine(std::map<K, V> x, std::map<K, V> y) {
-  x.merge(y);
-  return x;
-}
-
 namespace fs = std::filesystem;
 std::optional<std::string>
 get_absolute_path(std::string progn, const path &PATH) {
@@ -83,10 +183,76 @@ get_absolute_path(std::string progn, const path &PATH) {
   return std::nullopt;
 }
 
-std::map<std::string, Symbol> cmdline_args;
+// A source file, mapped in memory for the lexer to read in place (see
+// get_tokens()). What can't be mapped, like a pipe, is read instead, and a
+// file that can't be opened is empty.
+class MappedFile {
+public:
+  explicit MappedFile(const std::string &filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+      return;
+    struct stat st;
+    if ((fstat(fd, &st) == 0) && S_ISREG(st.st_mode) && (st.st_size > 0)) {
+      void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        mapped = static_cast<const char *>(p);
+        size = st.st_size;
+      }
+    }
+    if (mapped == nullptr) {
+      char buf[65536];
+      ssize_t n;
+      while ((n = read(fd, buf, sizeof buf)) > 0)
+        contents.append(buf, n);
+    }
+    close(fd);
+  }
+  ~MappedFile() {
+    if (mapped != nullptr)
+      munmap(const_cast<char *>(mapped), size);
+  }
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  std::string_view view() const {
+    return mapped ? std::string_view{mapped, size} : contents;
+  }
+
+private:
+  const char *mapped = nullptr;
+  std::size_t size = 0;
+  std::string contents;
+};
+
+std::optional<std::string> rewind_get_env_var(const std::string &query) {
+  const char *r = std::getenv(query.c_str());
+  if (r)
+    return std::optional<std::string>{std::string(r)};
+  return std::nullopt;
+}
+
+std::optional<std::vector<std::string>> rewind_get_system_PATH() {
+  auto opt = rewind_get_env_var("PATH");
+  if (opt == std::nullopt)
+    return std::nullopt;
+  std::vector<std::string> path_v;
+  std::string temp;
+  int pos = 0;
+  while ((pos = (*opt).find(':')) != std::string::npos) {
+    temp = (*opt).substr(0, pos);
+    path_v.push_back(temp);
+    (*opt).erase(0, pos + 1);
+  }
+  if (!(*opt).empty())
+    path_v.push_back(*opt);
+  return std::optional<std::vector<std::string>>{path_v};
+}
+
 void get_env_vars(Symbol node, path PATH) {
-  // called for the side effect of modifying the vector above.
-  auto nodel = std::get<std::list<Symbol>>(node.value);
+  // called for the side effect of modifying the environment_variables of
+  // the interpreter.
+  auto nodel = std::get<List>(node.value);
   auto _it = nodel.begin();
   auto lit = nodel.begin();
   lit = std::find_if(nodel.begin(), nodel.end(), [&](Symbol &s) -> bool {
@@ -101,7 +267,7 @@ void get_env_vars(Symbol node, path PATH) {
   while (_it != lit) {
     if (_it->type == Type::List) {
       // either a key/value pair for an env var, or a user error.
-      auto pairl = std::get<std::list<Symbol>>(_it->value);
+      auto pairl = std::get<List>(_it->value);
       if (pairl.size() != 2) {
         throw std::logic_error{
             "Invalid key/value assignment for an environment variable!\n"
@@ -118,12 +284,15 @@ void get_env_vars(Symbol node, path PATH) {
       std::string key = std::get<std::string>(fst.value);
       std::string value = std::visit(overloaded{
 	[](std::string s) { return s; },
-	[](unsigned long long int x) { return std::to_string(x); },
+	[](const BigInt& x) { return x.to_string(); },
+	[](double x) { return format_double(x); },
 	[](signed long long int x) { return std::to_string(x); },
 	[](bool b) -> std::string { return b ? "true" : "false"; },
-	[](std::list<Symbol> l) -> std::string { return ""; },
+	[](List l) -> std::string { return ""; },
+	[](const Map&) -> std::string { return ""; },
 	[](std::monostate) -> std::string { return ""; }
       }, snd.value);
+      auto &environment_variables = interp().environment_variables;
       if (environment_variables.empty()) {
         environment_variables.push_back(
             std::map<std::string, std::string>{{key, value}});
@@ -138,9 +307,6 @@ void get_env_vars(Symbol node, path PATH) {
   }
 }
 
-std::vector<std::pair<std::string, std::map<std::string, Symbol>>> call_stack;
-std::vector<std::map<std::string, std::pair<Symbol, Symbol>>>
-    user_defined_procedures;
 Symbol rewind_pipe(Symbol node, const std::vector<std::string> &PATH,
                    bool must_read);
 PidSym rewind_call_ext_program(Symbol node,
@@ -152,33 +318,35 @@ Symbol rewind_redirect_append(Symbol node,
 Symbol rewind_redirect_overwrite(Symbol node,
                                  const std::vector<std::string> &PATH);
 
-Symbol eval(Symbol root, const path &PATH, variables& vars = constants,
-            int line = 0);
+Symbol eval(Symbol root, const path &PATH,
+            variables &vars = interp().constants, int line = 0,
+            bool tail = false);
+Symbol run_toplevel(Symbol form, const path &PATH,
+                    variables &vars = interp().constants);
+Symbol vm_call(SymbolId name, const Symbol &func,
+               List args, const path &PATH);
+Symbol apply_function(const Symbol &func, List args, const path &PATH);
+const Builtin* procedure(SymbolId id);
+bool is_pure(const Builtin& b);
 
 
 std::optional<std::pair<Symbol, Symbol>> procedure_lookup(Symbol id) {
   if (!std::holds_alternative<std::string>(id.value))
     return std::nullopt;
-  if (user_defined_procedures.empty() ||
-      !user_defined_procedures[user_defined_procedures.size() - 1].contains(
-          std::get<std::string>(id.value))) {
+  auto &procedures = interp().user_defined_procedures;
+  if (procedures.empty() ||
+      !procedures.back().contains(std::get<std::string>(id.value))) {
     return std::nullopt;
   }
   return std::optional<std::pair<Symbol, Symbol>>{
-      user_defined_procedures[user_defined_procedures.size() - 1]
-                             [std::get<std::string>(id.value)]};
+      procedures.back()[std::get<std::string>(id.value)]};
 }
 
-std::optional<Symbol> callstack_variable_lookup(Symbol id) {
-  if (!std::holds_alternative<std::string>(id.value))
-    return std::nullopt;
-  if (call_stack.empty() || !call_stack[call_stack.size() - 1].second.contains(
-                                std::get<std::string>(id.value))) {
+std::optional<Symbol> callstack_variable_lookup(const Symbol &sym) {
+  auto &call_stack = interp().call_stack;
+  if ((sym.id == no_symbol) || call_stack.empty())
     return std::nullopt;
-  }
-  return std::optional<Symbol>{call_stack[call_stack.size() - 1]
-                                   .second[std::get<std::string>(id.value)]};
+  if (auto x = call_stack.back().slot(sym.id))
+    return std::optional<Symbol>{*x};
+  return std::nullopt;
 }
-
-std::array<std::string, 10> special_forms = {
-    "->", "let", "if", "$", "cond", "match", "<<<", "defined", "and", "or"};
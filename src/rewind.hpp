@@ -0,0 +1,134 @@
+#pragma once
+// Copyright 2023 Sofia Cerasuoli (@SwitchAxe)
+/*
+  This file is part of Rewind.
+  Rewind is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation, either version 3 of the license, or (at your
+  option) any later version.
+  Rewind is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Rewind. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// The API of librewind, for the programs embedding Rewind (see
+// librewind.cpp). It doesn't expose any of the interpreter's own headers.
+//
+//   librewind::Engine engine;
+//   engine.define_builtin("twice", [](const std::vector<librewind::Value>& a) {
+//     return librewind::Value(a[0].integer() * 2);
+//   }, 1);
+//   auto script = engine.compile("(+ (twice x) 1)", {"x"});
+//   for (long long i = 0; i < 10; ++i)
+//     script.run({i});
+//
+// Every error is thrown as a std::logic_error. An Engine and what it made
+// must only be used by one thread at a time, while separate engines can run
+// on separate threads at once.
+namespace librewind {
+
+struct ValueData;
+
+// a value of Rewind, shared and immutable
+class Value {
+public:
+  enum class Kind { Nothing, Integer, BigInteger, Double, String, Boolean,
+                    List, Map, Function };
+
+  Value();
+  Value(long long int n);
+  Value(int n) : Value(static_cast<long long int>(n)) {}
+  Value(double d);
+  Value(bool b);
+  Value(std::string s);
+  Value(const char *s) : Value(std::string{s}) {}
+  Value(const std::vector<Value> &l);
+
+  Kind kind() const;
+  // these throw unless the value is of the right kind
+  long long int integer() const;
+  double number() const; // an Integer, a BigInteger or a Double
+  bool boolean() const;
+  std::string string() const;
+  std::vector<Value> list() const;
+  std::vector<std::pair<Value, Value>> entries() const; // of a Map
+
+  // the value as Rewind prints it
+  std::string str() const;
+
+private:
+  friend struct Access;
+  std::shared_ptr<const ValueData> data;
+};
+
+// called with the arguments of a builtin the host program defined
+using Native = std::function<Value(const std::vector<Value> &)>;
+constexpr int variadic = -1;
+
+struct Options {
+  // where external programs are looked up, $PATH if empty
+  std::vector<std::string> path;
+  // evaluate on the tree-walker, like 'rewind --reference'
+  bool reference = false;
+};
+
+class Script;
+
+// an interpreter, with its own global variables
+class Engine {
+public:
+  explicit Engine(Options options = {});
+  ~Engine();
+  Engine(Engine &&) noexcept;
+  Engine &operator=(Engine &&) noexcept;
+
+  // binds a global variable. A global can't be bound twice: what changes
+  // between the runs of a Script should be one of its parameters.
+  void define(std::string_view name, const Value &v);
+  // makes 'fn' callable from Rewind code, like the builtins
+  void define_builtin(std::string_view name, Native fn, int arity = variadic);
+
+  // parses and compiles the source once, to run it as many times as
+  // needed. The parameters are bound to the arguments of each run, and
+  // read by their bare names, like the ones of a function.
+  Script compile(std::string_view source,
+                 const std::vector<std::string> &params = {});
+  // runs the source once, at the top level: its 'let's bind globals.
+  // Returns the value of the last expression.
+  Value eval(std::string_view source);
+
+private:
+  friend class Script;
+  struct Impl;
+  std::unique_ptr<Impl> impl;
+};
+
+// a compiled script, which must not outlive the Engine that made it
+class Script {
+public:
+  // sets a parameter for the runs without arguments
+  Script &bind(std::string_view param, const Value &v);
+  // runs with the values given to bind()
+  Value run() const;
+  // runs with these arguments, one per parameter
+  Value run(const std::vector<Value> &args) const;
+
+private:
+  friend class Engine;
+  struct Impl;
+  explicit Script(std::shared_ptr<Impl> impl);
+  std::shared_ptr<Impl> impl;
+};
+
+} // namespace librewind
@@ -15,7 +15,9 @@
   Rewind. If not, see <https://www.gnu.org/licenses/>.
 */
 #include "src/external.hpp"
+#include "src/image.hpp"
 #include "src/procedures.hpp"
+#include "src/vm.hpp"
 #include <cstdio>
 #include <cstdlib>
 #include <filesystem>
@@ -27,38 +29,6 @@
 #include <stdexcept>
 #include <string>
 #include <variant>
-std::string rewind_read_file(std::string filename) {
-  std::string expr;
-  std::string temp;
-  std::ifstream in(filename);
-  bool is_comment = false;
-  while (std::getline(in, temp)) {
-    // comments are skipped
-    is_comment = false;
-    for (auto ch : temp) {
-      if ((ch != ' ') && (ch != '\t')) {
-        if ((ch == '#') || is_comment) {
-          is_comment = true;
-        } else
-          is_comment = false;
-        break;
-      }
-    }
-    if (!is_comment)
-      expr += temp + "\n";
-  }
-  in.close();
-  return expr;
-}
-
-
-
-std::optional<std::string> rewind_get_env_var(const std::string &query) {
-  const char *r = std::getenv(query.c_str());
-  if (r)
-    return std::optional<std::string>{std::string(r)};
-  return std::nullopt;
-}
 
 std::optional<std::string> rewind_config_file() {
   std::optional<std::string> home = rewind_get_env_var("HOME");
@@ -80,38 +50,19 @@ std::optional<Symbol> rewind_read_config(const path &PATH) {
   if (conf == std::nullopt) {
     return std::nullopt;
   }
-  std::string content = rewind_read_file(*conf);
-  if (content == "") return std::nullopt;
-  auto expr_vec = get_tokens(content);
+  MappedFile content(*conf);
+  Symbol ast = parse_cached(content.view());
+  if (std::get<List>(ast.value).empty()) return std::nullopt;
   Symbol last_evaluated;
   Symbol last_expr;
-  Symbol ast;
   Symbol last;
-  ast = parse(expr_vec);
-  for (auto x : std::get<std::list<Symbol>>(ast.value)) {
+  for (auto x : std::get<List>(ast.value)) {
     last = x;
-    last_evaluated = eval(last, PATH);
+    last_evaluated = run_toplevel(last, PATH);
   }
   return last;
 }
 
-std::optional<std::vector<std::string>> rewind_get_system_PATH() {
-  auto opt = rewind_get_env_var("PATH");
-  if (opt == std::nullopt)
-    return std::nullopt;
-  std::vector<std::string> path_v;
-  std::string temp;
-  int pos = 0;
-  while ((pos = (*opt).find(':')) != std::string::npos) {
-    temp = (*opt).substr(0, pos);
-    path_v.push_back(temp);
-    (*opt).erase(0, pos + 1);
-  }
-  if (!(*opt).empty())
-    path_v.push_back(*opt);
-  return std::optional<std::vector<std::string>>{path_v};
-}
-
 std::string
 rewind_readline(std::optional<Symbol> maybe_prompt,
                 const std::optional<std::vector<std::string>> &PATH) {
@@ -123,9 +74,9 @@ rewind_readline(std::optional<Symbol> maybe_prompt,
     } else if (sym.type == Type::List) {
       Symbol evaluated;
       if (PATH != std::nullopt) {
-        evaluated = eval(sym, *PATH);
+        evaluated = run_toplevel(sym, *PATH);
       } else {
-        evaluated = eval(sym, {});
+        evaluated = run_toplevel(sym, {});
       }
       if (evaluated.type == Type::String) {
         prompt = std::get<std::string>(evaluated.value);
@@ -141,14 +92,11 @@ rewind_readline(std::optional<Symbol> maybe_prompt,
   return line;
 }
 
-void rewind_sh_loop() {
+// 'maybe_prompt' is what the config file ended with, see
+// rewind_read_config(). main() already ran it.
+void rewind_sh_loop(std::optional<Symbol> maybe_prompt) {
   std::string line;
   auto PATH = rewind_get_system_PATH();
-  std::optional<Symbol> maybe_prompt;
-  if (PATH != std::nullopt)
-    maybe_prompt = rewind_read_config(*PATH);
-  else
-    maybe_prompt = rewind_read_config({});
   if (PATH == std::nullopt)
     throw std::logic_error{
         "The system PATH is empty! I can't proceed. Aborting... \n"};
@@ -161,11 +109,11 @@ void rewind_sh_loop() {
       continue;
     try {
       Symbol ast = parse(get_tokens(line));
-      ast = std::get<std::list<Symbol>>(ast.value).front();
-      Symbol result = eval(ast, *PATH, vs, ast.line);
+      ast = std::get<List>(ast.value).front();
+      Symbol result = run_toplevel(ast, *PATH, vs);
       std::cout << rec_print_ast(result) << "\n";
     } catch (std::logic_error ex) {
-      procedures["cookedmode"](std::list<Symbol>{}, path{});
+      (*builtin("cookedmode"))(List{}, path{}, vs);
       std::cout << ex.what() << "\n";
       continue;
     }
@@ -0,0 +1,165 @@
+#pragma once
+// Copyright 2023 Sofia Cerasuoli (@SwitchAxe)
+/*
+  This file is part of Rewind.
+  Rewind is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation, either version 3 of the license, or (at your
+  option) any later version.
+  Rewind is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Rewind. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Reductions over arrays of doubles, for the numeric builtins (see 'sum'
+// and friends in builtins/numeric.hpp). On x86-64 the AVX2 kernels are
+// used if the CPU has them, and the SSE2 ones (which every x86-64 CPU
+// has) otherwise. The lanes are combined at the end, so the result can
+// differ from a left to right loop in the last bits.
+
+enum class Reduction { Sum, Product, Min, Max };
+
+template <Reduction Op>
+constexpr double identity() {
+  if constexpr (Op == Reduction::Sum)
+    return 0;
+  else if constexpr (Op == Reduction::Product)
+    return 1;
+  else if constexpr (Op == Reduction::Min)
+    return std::numeric_limits<double>::infinity();
+  else
+    return -std::numeric_limits<double>::infinity();
+}
+
+template <Reduction Op>
+double reduce_step(double a, double b) {
+  if constexpr (Op == Reduction::Sum)
+    return a + b;
+  else if constexpr (Op == Reduction::Product)
+    return a * b;
+  else if constexpr (Op == Reduction::Min)
+    return std::min(a, b);
+  else
+    return std::max(a, b);
+}
+
+template <Reduction Op>
+double reduce_scalar(const double* x, std::size_t n) {
+  double r = identity<Op>();
+  for (std::size_t i = 0; i < n; ++i)
+    r = reduce_step<Op>(r, x[i]);
+  return r;
+}
+
+double dot_scalar(const double* x, const double* y, std::size_t n) {
+  double r = 0;
+  for (std::size_t i = 0; i < n; ++i)
+    r += x[i] * y[i];
+  return r;
+}
+
+#if defined(__x86_64__)
+template <Reduction Op>
+__attribute__((target("avx2"))) double reduce_avx2(const double* x,
+                                                   std::size_t n) {
+  __m256d acc = _mm256_set1_pd(identity<Op>());
+  std::size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d v = _mm256_loadu_pd(x + i);
+    if constexpr (Op == Reduction::Sum)
+      acc = _mm256_add_pd(acc, v);
+    else if constexpr (Op == Reduction::Product)
+      acc = _mm256_mul_pd(acc, v);
+    else if constexpr (Op == Reduction::Min)
+      acc = _mm256_min_pd(acc, v);
+    else
+      acc = _mm256_max_pd(acc, v);
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, acc);
+  double r = reduce_scalar<Op>(lanes, 4);
+  return reduce_step<Op>(r, reduce_scalar<Op>(x + i, n - i));
+}
+
+template <Reduction Op>
+double reduce_sse2(const double* x, std::size_t n) {
+  __m128d acc = _mm_set1_pd(identity<Op>());
+  std::size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128d v = _mm_loadu_pd(x + i);
+    if constexpr (Op == Reduction::Sum)
+      acc = _mm_add_pd(acc, v);
+    else if constexpr (Op == Reduction::Product)
+      acc = _mm_mul_pd(acc, v);
+    else if constexpr (Op == Reduction::Min)
+      acc = _mm_min_pd(acc, v);
+    else
+      acc = _mm_max_pd(acc, v);
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, acc);
+  double r = reduce_scalar<Op>(lanes, 2);
+  return reduce_step<Op>(r, reduce_scalar<Op>(x + i, n - i));
+}
+
+__attribute__((target("avx2"))) double dot_avx2(const double* x,
+                                                const double* y,
+                                                std::size_t n) {
+  __m256d acc = _mm256_setzero_pd();
+  std::size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    acc = _mm256_add_pd(
+        acc, _mm256_mul_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+  double lanes[4];
+  _mm256_storeu_pd(lanes, acc);
+  return reduce_scalar<Reduction::Sum>(lanes, 4) +
+         dot_scalar(x + i, y + i, n - i);
+}
+
+double dot_sse2(const double* x, const double* y, std::size_t n) {
+  __m128d acc = _mm_setzero_pd();
+  std::size_t i = 0;
+  for (; i + 2 <= n; i += 2)
+    acc = _mm_add_pd(acc,
+                     _mm_mul_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));
+  double lanes[2];
+  _mm_storeu_pd(lanes, acc);
+  return lanes[0] + lanes[1] + dot_scalar(x + i, y + i, n - i);
+}
+
+bool has_avx2() {
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  return avx2;
+}
+#endif
+
+template <Reduction Op>
+double reduce(const double* x, std::size_t n) {
+#if defined(__x86_64__)
+  if (has_avx2())
+    return reduce_avx2<Op>(x, n);
+  return reduce_sse2<Op>(x, n);
+#else
+  return reduce_scalar<Op>(x, n);
+#endif
+}
+
+double reduce_dot(const double* x, const double* y, std::size_t n) {
+#if defined(__x86_64__)
+  if (has_avx2())
+    return dot_avx2(x, y, n);
+  return dot_sse2(x, y, n);
+#else
+  return dot_scalar(x, y, n);
+#endif
+}
@@ -14,20 +14,37 @@
   You should have received a copy of the GNU General Public License along with
   Rewind. If not, see <https://www.gnu.org/licenses/>.
 */
+#include "bigint.hpp"
+#include "heap.hpp"
+#include "intern.hpp"
 #include "utils.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
 #include <functional>
+#include <initializer_list>
 #include <list>
 #include <map>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <variant>
 #include <vector>
 
-enum class Type {
+enum class Type : std::uint8_t {
     String,
     Number,
     Boolean,
     List,
     ListLiteral,
+    Map,
+    MapLiteral, // '{k v ...}, which evaluates to a Map
     Function,
     Operator,
     Defunc,
@@ -41,91 +58,487 @@ enum class Type {
     RawAst, // for the 'ast' builtin. don't eval this type!
 };
 struct Symbol;
+struct Chunk; // compiled bytecode, see compiler.hpp
 
-using _Type = std::variant<std::monostate, long long int, long long unsigned int,
-    std::string, std::list<Symbol>, bool>;
+// the lists a thread may append to in place, see Seq::append(). Every
+// thread has an owner of its own, and so does every task of the parallel
+// builtins (see pool.hpp), so two threads never append to the same buffer.
+std::uint64_t next_list_owner()
+{
+    static std::atomic<std::uint64_t> last { 0 };
+    return ++last;
+}
+thread_local std::uint64_t list_owner = next_list_owner();
 
+// The children of a node (and every list value) are a slice of a
+// contiguous buffer, which copies of the Seq share: copying one, or taking
+// its tail, is O(1). The buffer is only copied when a Seq sharing it is
+// modified through one of the non-const members (copy on write), so
+// reading through a const Seq never copies anything.
+template <class T>
+class Seq {
+public:
+    using value_type = T;
+    using Items = std::vector<T, HeapAllocator<T>>;
+    using iterator = typename Items::iterator;
+    using const_iterator = typename Items::const_iterator;
+
+    Seq() = default;
+    Seq(std::initializer_list<T> il)
+        : buf(make_buffer(Items(il)))
+        , tail(il.size())
+    {
+    }
+    template <class It>
+    Seq(It first, It last)
+        : buf(make_buffer(Items(first, last)))
+        , tail(buf->items.size())
+    {
+    }
+    Seq(const Seq& other) = default;
+    Seq(Seq&& other) noexcept
+        : buf(std::move(other.buf))
+        , head(std::exchange(other.head, 0))
+        , tail(std::exchange(other.tail, 0))
+    {
+    }
+    Seq& operator=(const Seq& other) = default;
+    Seq& operator=(Seq&& other) noexcept
+    {
+        buf = std::move(other.buf);
+        head = std::exchange(other.head, 0);
+        tail = std::exchange(other.tail, 0);
+        return *this;
+    }
+    bool operator==(const Seq& other) const
+    {
+        return std::equal(begin(), end(), other.begin(), other.end());
+    }
+
+    iterator begin()
+    {
+        detach();
+        return buf->items.begin() + head;
+    }
+    iterator end()
+    {
+        detach();
+        return buf->items.begin() + tail;
+    }
+    const_iterator begin() const
+    {
+        return buf ? buf->items.cbegin() + head : const_iterator {};
+    }
+    const_iterator end() const
+    {
+        return buf ? buf->items.cbegin() + tail : const_iterator {};
+    }
+    std::size_t size() const { return tail - head; }
+    bool empty() const { return tail == head; }
+    T& front() { return *begin(); }
+    T& back() { return *(end() - 1); }
+    const T& front() const { return buf->items[head]; }
+    const T& back() const { return buf->items[tail - 1]; }
+    T& operator[](std::size_t i) { return *(begin() + i); }
+    const T& operator[](std::size_t i) const { return buf->items[head + i]; }
+
+    void push_back(const T& x)
+    {
+        detach();
+        buf->items.push_back(x);
+        tail++;
+    }
+    // like push_back, but doesn't copy the buffer if nothing past the end of
+    // this Seq was written to it yet, so that a list built by appending to
+    // its copies takes amortized O(1) per element. Iterators into other Seqs
+    // sharing the buffer are invalidated. A buffer shared with another
+    // thread is never written to.
+    void append(const T& x)
+    {
+        if (!can_append())
+            detach();
+        buf->items.push_back(x);
+        tail++;
+    }
+    void append(const Seq& other)
+    {
+        if (!can_append())
+            detach();
+        // 'other' may share our buffer, so make room before copying
+        if (buf->items.capacity() < tail + other.size())
+            buf->items.reserve(std::max(2 * tail, tail + other.size()));
+        for (std::size_t i = 0; i < other.size(); ++i)
+            buf->items.push_back(other[i]);
+        tail = buf->items.size();
+    }
+    void pop_back()
+    {
+        assert(!empty());
+        tail--;
+    }
+    void pop_front()
+    {
+        assert(!empty());
+        head++;
+    }
+    void push_front(const T& x)
+    {
+        detach();
+        if (head > 0) {
+            buf->checked = std::min(buf->checked.load(), head - 1);
+            buf->items[--head] = x;
+        } else {
+            buf->checked = 0;
+            buf->items.insert(buf->items.begin(), x);
+            tail++;
+        }
+    }
+    iterator insert(const_iterator pos, const T& x)
+    {
+        auto i = pos - begin_const();
+        detach();
+        tail++;
+        return buf->items.insert(buf->items.begin() + head + i, x);
+    }
+    template <class It>
+    iterator insert(const_iterator pos, It first, It last)
+    {
+        auto i = pos - begin_const();
+        Items xs(first, last); // [first, last) may be in the buffer
+        detach();
+        tail += xs.size();
+        return buf->items.insert(buf->items.begin() + head + i, xs.begin(), xs.end());
+    }
+    // true if 'pred' holds for every element. It must be the same predicate
+    // every time: the buffer remembers how many of its elements passed
+    // already, so checking a list again after taking its tail or appending
+    // to it only costs the new elements.
+    template <class Pred>
+    bool all_of(Pred pred) const
+    {
+        if (empty())
+            return true;
+        // other threads may be checking the same buffer
+        std::size_t i = buf->checked.load(std::memory_order_relaxed);
+        while ((i < tail) && pred(buf->items[i]))
+            i++;
+        if (i > buf->checked.load(std::memory_order_relaxed))
+            buf->checked.store(i, std::memory_order_relaxed);
+        if (i >= tail)
+            return true;
+        if (i >= head)
+            return false;
+        // what failed isn't part of this slice
+        return std::all_of(begin(), end(), pred);
+    }
+    iterator erase(const_iterator pos)
+    {
+        auto i = pos - begin_const();
+        detach();
+        tail--;
+        return buf->items.erase(buf->items.begin() + head + i);
+    }
+
+private:
+    const_iterator begin_const() const { return begin(); }
+    bool can_append() const
+    {
+        return buf && (tail == buf->items.size())
+            && ((buf.use_count() == 1) || (buf->owner == list_owner));
+    }
+    // makes the buffer ours alone, and drops what's outside of the slice.
+    // Called before anything may change the elements.
+    void detach()
+    {
+        if (!buf) {
+            buf = make_buffer({});
+            head = tail = 0;
+        } else if (buf.use_count() > 1) {
+            buf = make_buffer(Items(
+                buf->items.begin() + head, buf->items.begin() + tail));
+            head = 0;
+            tail = buf->items.size();
+        } else {
+            if (tail < buf->items.size())
+                buf->items.erase(buf->items.begin() + tail, buf->items.end());
+            buf->checked = std::min(buf->checked.load(), head);
+        }
+    }
+
+    struct Buffer {
+        Items items;
+        // see all_of(), the elements before this one are known to pass
+        std::atomic<std::size_t> checked = 0;
+        std::uint64_t owner = list_owner;
+    };
+    // buffers, and the elements in them, live on the heap of heap.hpp
+    static std::shared_ptr<Buffer> make_buffer(Items items)
+    {
+        return std::allocate_shared<Buffer>(HeapAllocator<Buffer> {}, std::move(items));
+    }
+    std::shared_ptr<Buffer> buf;
+    std::size_t head = 0; // this Seq is items[head, tail)
+    std::size_t tail = 0;
+};
+using List = Seq<Symbol>;
+
+// A persistent hash map from values to values (see map.hpp). Updates return
+// a new map and leave this one as it is, sharing everything but the path to
+// the entry that changed, so copying a map is O(1) and updating one
+// O(log n).
+class Map {
+public:
+    Map() = default;
+
+    std::size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    // nullptr if the key isn't in the map
+    const Symbol* find(const Symbol& key) const;
+    Map insert(const Symbol& key, const Symbol& value) const;
+    Map erase(const Symbol& key) const;
+    // calls f(key, value) for every entry, in no particular order
+    template <class F>
+    void for_each(F f) const;
+    bool operator==(const Map& other) const;
+
+private:
+    struct Node;
+    std::shared_ptr<const Node> root;
+    std::size_t count = 0;
+};
+
+// integers are int64s, and BigInts only when they don't fit in one
+using _Type = std::variant<std::monostate, long long int, BigInt, double,
+    std::string, List, bool, Map>;
+
+// A node of the tree built by the parser, and every value at run time.
+// Kept small since it's copied around a lot: the payload, the node type
+// and the source metadata of the node, and nothing else.
 struct Symbol {
     Symbol() = default;
     bool operator==(const Symbol&) const = default;
-    Symbol(std::string _n, _Type _v, Type _t)
-    {
-        name = _n;
-        value = _v;
-        type = _t;
-        is_global = false;
-    }
-    Symbol(std::string _n, _Type _v, Type _t, bool _b)
+    Symbol(_Type _v, Type _t, bool _b = false)
+        : value(std::move(_v))
+        , type(_t)
+        , is_global(_b)
     {
-        name = _n;
-        value = _v;
-        type = _t;
-        is_global = _b;
+        if (((_t == Type::Identifier) || (_t == Type::Operator))
+            && std::holds_alternative<std::string>(value))
+            id = intern(std::get<std::string>(value));
     }
-    std::string name; // empty string if not present
     _Type value;
-    Type type;
-    bool is_block;
-    bool is_global;
-    int line;
-    // this is associated with any symbol, but it's useful for
-    // functions.
-    std::map<std::string, Symbol> variables;
+    Type type = Type::String;
+    bool is_block = false;
+    bool is_global = false;
+    SymbolId id = no_symbol; // interned name of identifiers and operators
+    int line = 0;
+    // the compiled body of a Type::Function symbol. shared between
+    // all the copies of the same function.
+    std::shared_ptr<const Chunk> code;
 };
 
+// a Type::Number symbol, in the narrowest representation for 'n'
+Symbol make_number(BigInt n)
+{
+    if (n.fits_int64())
+        return Symbol(n.to_int64(), Type::Number);
+    return Symbol(std::move(n), Type::Number);
+}
+
+// the shortest string in fixed notation that reads back as 'd' (see
+// try_convert_double()), with a ".0" if it would read back as an integer.
+// Infinities and NaNs have no literal, and are printed as inf and nan.
+std::string format_double(double d)
+{
+    // wide enough for the largest double and the smallest subnormal
+    char buf[400];
+    auto [end, ec] = std::to_chars(buf, buf + sizeof buf, d,
+        std::chars_format::fixed);
+    std::string s(buf, end);
+    if (std::isfinite(d) && (s.find('.') == std::string::npos))
+        s += ".0";
+    return s;
+}
+
 // function signature for the builtins
 using path = std::vector<std::string>;
-using variables = std::map<std::string, Symbol>;
-struct Functor {
-    using sig = std::function<Symbol(std::list<Symbol>)>;
-    using psig = std::function<Symbol(std::list<Symbol>, path)>;
-    using pvsig = std::function<Symbol(std::list<Symbol>, path, variables&)>;
-    using vsig = std::function<Symbol(std::list<Symbol>, variables&)>;
-    Functor()
-        : _fn([](std::list<Symbol>) { return Symbol(); })
-        , _Pfn([](std::list<Symbol>, path) { return Symbol(); })
-        , _PVfn([](std::list<Symbol>, path, variables&) { return Symbol(); })
+
+// bumps the binding_version of the current interpreter, see
+// Interpreter in procedures.hpp
+void function_bound();
+
+// a 'let' of a function that 'load' left for later: parsed and run the
+// first time its name is looked up
+struct LazyDefinition {
+    std::shared_ptr<const std::string> source; // of the whole file
+    std::size_t first = 0, last = 0; // the bytes of the 'let' in 'source'
+    int line = 0; // of the 'let'
+    std::string file;
+};
+
+class Env;
+// binds the lazy definition of 'id' in 'globals', see vm.hpp
+Symbol* bind_pending(Env& globals, SymbolId id);
+
+// a set of bindings, keyed on the interned names of the variables.
+// the string overloads intern their argument first.
+// An Env can sit on top of a parent scope (the globals, for a function
+// call): lookups fall through to the parent, while new bindings stay in
+// the child, so opening a scope doesn't copy anything.
+class Env {
+public:
+    using map = std::unordered_map<SymbolId, Symbol>;
+
+    Env() = default;
+    explicit Env(Env* _parent)
+        : parent(_parent)
+    {
+    }
+
+    // nullptr if the name isn't bound here or in any parent scope
+    Symbol* find(SymbolId id)
     {
+        for (Env* e = this; e != nullptr; e = e->parent) {
+            if (auto it = e->bindings.find(id); it != e->bindings.end())
+                return &it->second;
+            if (!e->lazy.empty() && e->lazy.contains(id))
+                return bind_pending(*e, id);
+        }
+        return nullptr;
     }
-    Functor(sig&& s)
-        : _fn(s)
+    Symbol* find(std::string_view name) { return find(intern(name)); }
+    bool contains(SymbolId id) const
     {
+        return const_cast<Env*>(this)->find(id) != nullptr;
     }
-    Functor(psig&& s)
-        : _Pfn(s)
+    bool contains(std::string_view name) const
     {
+        return contains(intern(name));
     }
-    Functor(pvsig&& s)
-        : _PVfn(s)
+    Symbol& operator[](SymbolId id)
     {
+        if (Symbol* s = find(id))
+            return *s;
+        return bindings[id];
     }
-    Functor(vsig&& s)
-        : _Vfn(s)
+    Symbol& operator[](std::string_view name) { return (*this)[intern(name)]; }
+    // like inserting into a copy of the parent: a name that's already
+    // visible keeps its binding.
+    bool insert(const std::pair<SymbolId, Symbol>& kv)
     {
+        if (contains(kv.first))
+            return false;
+        if (!bindings.insert(kv).second)
+            return false;
+        if (kv.second.type == Type::Function) {
+            functions++;
+            function_bound();
+        }
+        return true;
     }
-    auto operator()(std::list<Symbol> l, path P, variables& v)
+    bool insert(const std::pair<std::string, Symbol>& kv)
     {
-        if (_PVfn)
-            return _PVfn(l, P, v);
-        if (_Pfn)
-            return _Pfn(l, P);
-        return _fn(l);
+        return insert({ intern(kv.first), kv.second });
     }
 
-    auto operator()(std::list<Symbol> l, variables& V) -> Symbol
+    // calls f(id, symbol) for every binding of this scope, but not of its
+    // parents
+    template <class F>
+    void for_each(F f) const
     {
-        return (_Vfn) ? _Vfn(l, V) : _fn(l);
-    };
+        for (auto& [id, s] : bindings)
+            f(id, s);
+    }
 
-    auto operator()(std::list<Symbol> l, path P) -> Symbol
+    // true if this scope, or a parent below 'root', binds any function
+    bool binds_functions(const Env* root) const
     {
-        return (_Pfn) ? _Pfn(l, P) : _fn(l);
-    };
-    auto operator()(std::list<Symbol> l) -> Symbol { return _fn(l); };
-    sig _fn;
-    psig _Pfn;
-    pvsig _PVfn;
-    vsig _Vfn;
+        for (const Env* e = this; (e != nullptr) && (e != root); e = e->parent)
+            if (e->functions > 0)
+                return true;
+        return false;
+    }
+
+    // the definitions 'load' left for later, by name. Only the globals
+    // have any.
+    std::unordered_map<SymbolId, LazyDefinition> lazy;
+
+private:
+    map bindings;
+    Env* parent = nullptr;
+    std::size_t functions = 0; // how many of the bindings are functions
+};
+using variables = Env;
+
+// how a builtin takes its arguments, see Builtin
+enum class Conv : std::uint8_t {
+    Args, // f(args)
+    ArgsPath, // f(args, PATH)
+    ArgsPathVars, // f(args, PATH, vars)
+};
+
+// An entry of the builtin table (see builtins/include.hpp), built at compile
+// time out of a captureless lambda. Every builtin is called through the same
+// plain function pointer, whatever its convention. The builtins a host
+// program registers at run time (see Interpreter::define_builtin()) call a
+// 'native' function instead.
+struct Builtin {
+    static constexpr int variadic = -1;
+    using fn_type = Symbol (*)(List, const path&, variables&);
+    using native_type = std::function<Symbol(List)>;
+
+    constexpr Builtin() = default;
+    template <class F>
+    constexpr Builtin(std::string_view _name, F, int _arity = variadic)
+        : name(_name)
+        , conv(conv_of<F>())
+        , arity(_arity)
+        , fn(&call<F>)
+    {
+    }
+    static Builtin host(std::string_view name, const native_type* native,
+        int arity)
+    {
+        Builtin b;
+        b.name = name;
+        b.arity = arity;
+        b.native = native;
+        return b;
+    }
+    Symbol operator()(List args, const path& PATH, variables& vars) const
+    {
+        if (native != nullptr)
+            return (*native)(std::move(args));
+        return fn(std::move(args), PATH, vars);
+    }
+
+    std::string_view name;
+    Conv conv = Conv::Args;
+    int arity = variadic; // the exact number of arguments, if not variadic
+    fn_type fn = nullptr;
+    const native_type* native = nullptr;
+
+private:
+    template <class F>
+    static constexpr Conv conv_of()
+    {
+        if constexpr (std::is_invocable_v<F, List, const path&, variables&>)
+            return Conv::ArgsPathVars;
+        else if constexpr (std::is_invocable_v<F, List, const path&>)
+            return Conv::ArgsPath;
+        else
+            return Conv::Args;
+    }
+    template <class F>
+    static Symbol call(List args, const path& PATH, variables& vars)
+    {
+        if constexpr (conv_of<F>() == Conv::ArgsPathVars)
+            return F {}(std::move(args), PATH, vars);
+        else if constexpr (conv_of<F>() == Conv::ArgsPath)
+            return F {}(std::move(args), PATH);
+        else
+            return F {}(std::move(args));
+    }
 };
 
 template <class T>
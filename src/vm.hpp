@@ -0,0 +1,495 @@
+#pragma once
+// Copyright 2023 Sofia Cerasuoli (@SwitchAxe)
+/*
+  This file is part of Rewind.
+  Rewind is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation, either version 3 of the license, or (at your
+  option) any later version.
+  Rewind is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Rewind. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "compiler.hpp"
+#include "evaluator.hpp"
+#include "pool.hpp"
+#include "procedures.hpp"
+#include "src/builtins/include.hpp"
+#include <algorithm>
+#include <list>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// The register machine running the bytecode from compiler.hpp.
+// Calls between compiled functions don't recurse on the C++ stack: every
+// call pushes an Activation, whose registers are a window of 'regs'.
+
+struct Activation {
+  std::shared_ptr<const Chunk> chunk;
+  std::size_t pc = 0;
+  std::size_t base = 0; // R[0] of this activation is regs[base]
+  int ret = 0; // the caller's register receiving our result
+  bool is_call = false; // true if we pushed a frame on the call stack
+  variables locals{};
+  variables* outer = nullptr; // top-level forms use the caller's variables
+  // the function running, which its body can call by the name it was
+  // called with. Only set if the body refers to that name at all.
+  SymbolId name = no_symbol;
+  Symbol self{};
+  // the arguments of a call to a memoized function, to remember its result
+  // by once it returns. Such a call is never replaced by a tail call.
+  std::optional<List> memo_key{};
+  variables& vars() { return outer ? *outer : locals; }
+  // the variables, as the tree-walker and the builtins must see them
+  variables& env() {
+    if (self.type == Type::Function) {
+      locals.insert({name, std::move(self)});
+      self = Symbol();
+    }
+    return vars();
+  }
+
+  // 'self' is only set when 'locals' is empty
+  Symbol* find(SymbolId id) {
+    if ((id == name) && (self.type == Type::Function))
+      return &self;
+    return vars().find(id);
+  }
+  // true if a function is bound in this activation only
+  bool binds_functions() {
+    return (self.type == Type::Function) ||
+           vars().binds_functions(&interp().constants);
+  }
+};
+
+// a function's own name is the only thing it can capture: it can't see
+// the variables of its caller. Bodies that fall back to the tree-walker
+// look it up among their variables, the others keep it in 'self', and
+// only if they mention it (see Chunk::captures), so calling a function
+// that doesn't builds no environment at all.
+void bind_self(Activation& act, SymbolId name, const Symbol& func) {
+  const Chunk& ch = *act.chunk;
+  act.name = name;
+  if (ch.needs_env)
+    act.locals.insert({name, func});
+  // a global function is found among the globals anyway
+  bool captured = !ch.needs_env &&
+                  (std::find(ch.captures.begin(), ch.captures.end(), name) !=
+                   ch.captures.end()) &&
+                  !interp().constants.contains(name);
+  if (captured && (act.self.code != func.code))
+    act.self = func;
+  else if (!captured && (act.self.type == Type::Function))
+    act.self = Symbol(); // left over from the function we replaced
+}
+
+std::logic_error arity_mismatch(SymbolId name, const Symbol& func,
+                                std::size_t expected,
+                                const List& args) {
+  auto node = args;
+  node.push_front(Symbol(symbol_name(name), Type::Operator));
+  return std::logic_error{"Expected arity (" + std::to_string(expected) +
+                          ")" + " and supplied number of arguments (" +
+                          std::to_string(args.size()) + ") for call to " +
+                          rec_print_ast(func) + " don't match!\n" +
+                          "the call was: " +
+                          rec_print_ast(Symbol(node, Type::List)) + "\n"};
+}
+
+// the arguments must already be in regs[base]...
+void vm_enter(std::vector<Activation>& frames, std::vector<Symbol>& regs,
+              SymbolId name, const Symbol& func,
+              std::shared_ptr<const Chunk> code, std::size_t base, int ret) {
+  Interpreter& rt = interp();
+  regs.resize(base + code->nregs);
+  rt.call_stack.push_back(Frame{.function = name,
+                                .params = {code, &code->params},
+                                .regs = &regs,
+                                .base = base});
+  Activation act{.chunk = code, .base = base, .ret = ret, .is_call = true};
+  act.locals = variables{&rt.constants};
+  bind_self(act, name, func);
+  frames.push_back(std::move(act));
+}
+
+// a call in tail position: the running activation becomes the callee's,
+// so tail calls take no space. The arguments must already be in
+// regs[base]...
+void vm_replace(std::vector<Activation>& frames, std::vector<Symbol>& regs,
+                SymbolId name, const Symbol& func,
+                std::shared_ptr<const Chunk> code) {
+  Interpreter& rt = interp();
+  auto& f = frames.back();
+  regs.resize(f.base + code->nregs);
+  rt.call_stack.back() = Frame{.function = name,
+                               .params = {code, &code->params},
+                               .regs = &regs,
+                               .base = f.base};
+  f.chunk = code;
+  f.pc = 0;
+  f.locals = variables{&rt.constants};
+  bind_self(f, name, func);
+}
+
+Symbol vm_run(std::vector<Activation>& frames, std::vector<Symbol>& regs,
+              const path& PATH) {
+  // the chunks, and so their caches, are shared by every thread. Only the
+  // main thread uses them.
+  const bool use_caches = !ThreadPool::on_worker();
+  Interpreter& rt = interp();
+  for (;;) {
+    auto& f = frames.back();
+    const Chunk& ch = *f.chunk;
+    const Instr& in = ch.code[f.pc];
+    int line = ch.lines[f.pc];
+    f.pc++;
+    auto R = [&](int i) -> Symbol& { return regs[f.base + i]; };
+    switch (in.op) {
+    case OpCode::LoadConst:
+      R(in.a) = ch.pool[in.b];
+      break;
+    case OpCode::Move:
+      R(in.a) = R(in.b);
+      break;
+    case OpCode::LoadName:
+      if (auto x = callstack_variable_lookup(ch.pool[in.b]); x != std::nullopt)
+        R(in.a) = *x;
+      else
+        R(in.a) = ch.pool[in.b];
+      break;
+    case OpCode::LoadVar: {
+      SymbolId name = in.b;
+      if (Symbol* x = rt.constants.find(name))
+        R(in.a) = *x;
+      else if (in.e >= 0) // bound by a 'let' at the top of the function
+        R(in.a) = R(in.e);
+      else if (Symbol* x = f.find(name))
+        R(in.a) = *x;
+      else
+        throw std::logic_error{"Unbound variable " + symbol_name(name) + "!"};
+      break;
+    }
+    case OpCode::LoadFolded: {
+      // the builtins folded into K[b] are only checked again once a
+      // function is bound somewhere, see CallCache.
+      CallCache& cache = ch.caches[f.pc - 1];
+      bool shadowed = false;
+      bool local_functions = f.binds_functions();
+      if (!use_caches || (cache.version != rt.binding_version) ||
+          local_functions) {
+        for (auto& g : std::get<List>(ch.pool[in.d].value)) {
+          Symbol* x = f.find(g.id);
+          shadowed = shadowed || (x && (x->type == Type::Function));
+        }
+        if (use_caches && !shadowed && !local_functions)
+          cache.version = rt.binding_version;
+      }
+      if (shadowed)
+        R(in.a) = eval(ch.pool[in.c], PATH, f.env(), line);
+      else
+        R(in.a) = ch.pool[in.b];
+      break;
+    }
+    case OpCode::MakeList: {
+      List l;
+      for (int i = in.b; i < in.b + in.c; ++i)
+        l.push_back(R(i));
+      R(in.a) = Symbol(l, Type::ListLiteral);
+      break;
+    }
+    case OpCode::MakeMap:
+      R(in.a) = make_map(regs.begin() + f.base + in.b,
+                         regs.begin() + f.base + in.b + in.c);
+      break;
+    case OpCode::Let: {
+      SymbolId name = in.b;
+      if (in.d)
+        rt.constants.insert({name, R(in.c)});
+      else if (in.e >= 0) {
+        if (!rt.constants.contains(name))
+          R(in.e) = R(in.c);
+      } else
+        f.vars().insert({name, R(in.c)});
+      R(in.a) = Symbol(true, Type::Command);
+      break;
+    }
+    case OpCode::CheckBool:
+      if (R(in.a).type != Type::Boolean)
+        throw std::logic_error{
+            "Rewind (line " + std::to_string(line) +
+            "): Type mismatch in the '" + symbol_name(in.b) +
+            "' operator: Only booleans are allowed!\n"};
+      break;
+    case OpCode::Jump:
+      f.pc = in.a;
+      break;
+    case OpCode::JumpIfFalse:
+      if (!convert_value_to_bool(R(in.a)))
+        f.pc = in.b;
+      break;
+    case OpCode::JumpIfTrue:
+      if (convert_value_to_bool(R(in.a)))
+        f.pc = in.b;
+      break;
+    case OpCode::Eval: {
+      if (!in.d) {
+        R(in.a) = eval(ch.pool[in.b], PATH, f.env(), line);
+        break;
+      }
+      Symbol result = eval_tail(ch.pool[in.b], PATH, f.env(), line);
+      if (result.type != Type::RecFunCall) {
+        R(in.a) = result;
+        break;
+      }
+      // see tail_call()
+      auto args = std::get<List>(result.value);
+      Symbol func = args.front();
+      args.pop_front();
+      Symbol op = args.front();
+      args.pop_front();
+      auto code = func.code;
+      if ((code == nullptr) || code->memo ||
+          (code->params.size() != args.size())) {
+        args.push_front(op);
+        result = eval_function(Symbol(args, Type::List), PATH, line, func);
+        while (result.type == Type::RecFunCall)
+          result = eval_function(result, PATH, line);
+        R(in.a) = result;
+        break;
+      }
+      std::size_t base = f.is_call ? f.base : f.base + ch.nregs;
+      regs.resize(std::max(regs.size(), base + args.size()));
+      for (std::size_t i = 0; i < args.size(); ++i)
+        regs[base + i] = std::move(args[i]);
+      if (f.is_call)
+        vm_replace(frames, regs, op.id, func, code);
+      else
+        vm_enter(frames, regs, op.id, func, code, base, in.a);
+      break;
+    }
+    case OpCode::Call:
+    case OpCode::TailCall: {
+      SymbolId name = in.b;
+      List args;
+      bool is_param = (in.e >= 0) && (std::size_t(in.e) < ch.params.size());
+      if (is_param && (R(in.e).type != Type::Function)) {
+        // a parameter that isn't a function: the call is just data.
+        args.push_back(R(in.e));
+        for (int i = in.c; i < in.c + in.d; ++i)
+          args.push_back(R(i));
+        R(in.a) = Symbol(args, Type::List);
+        break;
+      }
+      const Symbol* callee = nullptr;
+      const Builtin* proc = nullptr;
+      CallCache& cache = ch.caches[f.pc - 1];
+      if (use_caches && (cache.version == rt.binding_version)) {
+        callee = cache.function;
+        // a local function could shadow the builtin in this activation only
+        if ((cache.builtin != nullptr) && !f.binds_functions())
+          proc = cache.builtin;
+      }
+      if ((callee == nullptr) && (proc == nullptr)) {
+        // same lookup order as eval_primitive_node()
+        bool global = false;
+        if (Symbol* x = rt.constants.find(name)) {
+          if (x->type == Type::Function) {
+            callee = x;
+            global = true;
+          }
+        } else if (Symbol* x = f.find(name)) {
+          if (x->type == Type::Function)
+            callee = x;
+        }
+        if ((callee == nullptr) && (in.e >= 0) &&
+            (R(in.e).type == Type::Function))
+          callee = &R(in.e);
+        if (callee == nullptr)
+          proc = procedure(name);
+        // what the parameters and the local variables hold can change
+        // between two runs of the same call, so those aren't cached.
+        if (use_caches && (in.e < 0) && (global || (proc != nullptr)))
+          cache = {.version = rt.binding_version,
+                   .function = global ? callee : nullptr,
+                   .builtin = proc};
+      }
+      if (callee != nullptr) {
+        Symbol func = *callee;
+        auto code = func.code ? func.code : compile_function(func);
+        if ((code == nullptr) || (code->params.size() != std::size_t(in.d))) {
+          for (int i = in.c; i < in.c + in.d; ++i)
+            args.push_back(R(i));
+          if (code != nullptr)
+            throw arity_mismatch(name, func, code->params.size(), args);
+          // not compilable, run it on the tree-walker
+          args.push_front(Symbol(symbol_name(name), Type::Operator));
+          Symbol result =
+              eval_function(Symbol(args, Type::List), PATH, line, func);
+          while (result.type == Type::RecFunCall)
+            result = eval_function(result, PATH, line);
+          R(in.a) = result;
+          break;
+        }
+        std::optional<List> key;
+        if (code->memo) {
+          key.emplace(regs.begin() + f.base + in.c,
+                      regs.begin() + f.base + in.c + in.d);
+          if (auto hit = code->memo->find(*key)) {
+            R(in.a) = std::move(*hit);
+            break;
+          }
+        }
+        if ((in.op == OpCode::TailCall) && f.is_call && !key && !f.memo_key) {
+          for (int i = 0; i < in.d; ++i)
+            if (in.c != 0)
+              regs[f.base + i] = std::move(regs[f.base + in.c + i]);
+          vm_replace(frames, regs, name, func, code);
+          break;
+        }
+        std::size_t base = f.base + ch.nregs;
+        int ret = in.a;
+        regs.resize(base + code->nregs);
+        for (int i = 0; i < in.d; ++i)
+          regs[base + i] = std::move(regs[f.base + in.c + i]);
+        vm_enter(frames, regs, name, func, code, base, ret);
+        frames.back().memo_key = std::move(key);
+        break;
+      }
+      if (proc == nullptr)
+        throw std::logic_error{"Rewind (line" + std::to_string(line) +
+                               "): Unbound procedure " + symbol_name(name) +
+                               "!\n"};
+      for (int i = in.c; i < in.c + in.d; ++i)
+        args.push_back(R(i));
+      Symbol result;
+      try {
+        check_arity(*proc, args.size());
+        result = (*proc)(std::move(args), PATH, f.env());
+      } catch (std::logic_error ex) {
+        throw std::logic_error{"Rewind (line " + std::to_string(line) +
+                               "): " + ex.what()};
+      }
+      if (!is_self_evaluating(result))
+        result = eval(result, PATH, f.env(), line);
+      R(in.a) = result;
+      break;
+    }
+    case OpCode::Return: {
+      Symbol result = std::move(R(in.a));
+      if (f.memo_key)
+        f.chunk->memo->insert(*f.memo_key, result);
+      if (f.is_call)
+        rt.call_stack.pop_back();
+      std::size_t base = f.base;
+      int ret = f.ret;
+      frames.pop_back();
+      regs.resize(base);
+      if (frames.empty())
+        return result;
+      regs[frames.back().base + ret] = std::move(result);
+      break;
+    }
+    }
+  }
+}
+
+Symbol vm_execute(std::vector<Activation>& frames, std::vector<Symbol>& regs,
+                  const path& PATH, std::size_t depth) {
+  try {
+    return vm_run(frames, regs, PATH);
+  } catch (...) {
+    // drop the frames of the calls we were in the middle of
+    interp().call_stack.resize(depth);
+    throw;
+  }
+}
+
+// runs a user function on the VM, from the tree-walker.
+Symbol vm_call(SymbolId name, const Symbol& func,
+               List args, const path& PATH) {
+  auto code = func.code;
+  if (code->params.size() != args.size())
+    throw arity_mismatch(name, func, code->params.size(), args);
+  if (code->memo)
+    if (auto hit = code->memo->find(args))
+      return *hit;
+  std::vector<Activation> frames;
+  std::vector<Symbol> regs(args.begin(), args.end());
+  auto depth = interp().call_stack.size();
+  vm_enter(frames, regs, name, func, code, 0, 0);
+  if (code->memo)
+    frames.back().memo_key = std::move(args);
+  return vm_execute(frames, regs, PATH, depth);
+}
+
+// function literals are compiled as soon as they're parsed, before the
+// 'let's above them ran. Once those globals are bound, compiling the
+// functions again lets the compiler use their values as constants.
+bool refold(Symbol& node) {
+  bool bound = false;
+  if ((node.type == Type::Identifier) &&
+      std::holds_alternative<std::string>(node.value)) {
+    auto& name = std::get<std::string>(node.value);
+    if ((name.size() > 1) && (name[0] == '$'))
+      bound = interp().constants.contains(std::string_view{name}.substr(1));
+  }
+  if (auto l = std::get_if<List>(&node.value))
+    for (auto& x : *l)
+      bound = refold(x) || bound;
+  if (bound && (node.type == Type::Function))
+    node.code = compile_function(node);
+  return bound;
+}
+
+// evaluates a top-level form, on the VM unless we're in reference mode.
+Symbol run_toplevel(Symbol form, const path& PATH, variables& vars) {
+  if (interp().reference_mode)
+    return eval(form, PATH, vars, form.line);
+  refold(form);
+  auto code = compile_toplevel(form);
+  std::vector<Activation> frames;
+  std::vector<Symbol> regs(code->nregs);
+  frames.push_back(Activation{.chunk = code, .outer = &vars});
+  return vm_execute(frames, regs, PATH, interp().call_stack.size());
+}
+
+// the first lookup of a function 'load' left for later parses its 'let'
+// and runs it, as 'load' would have. A worker of the parallel builtins
+// can't touch the globals of its caller, so it binds its own copy.
+Symbol* bind_pending(Env& globals, SymbolId id) {
+  // the 'let' looks the name up again before binding it
+  static thread_local std::vector<SymbolId> binding;
+  if (std::find(binding.begin(), binding.end(), id) != binding.end())
+    return nullptr;
+  Interpreter& rt = interp();
+  auto it = globals.lazy.find(id);
+  LazyDefinition def = it->second;
+  if (&globals == &rt.constants)
+    globals.lazy.erase(it);
+  binding.push_back(id);
+  struct Done {
+    ~Done() { binding.pop_back(); }
+  } done;
+  try {
+    std::string_view text{*def.source};
+    auto tokens = get_tokens(text.substr(def.first, def.last - def.first));
+    for (auto& t : tokens)
+      t.line += def.line;
+    RecInfo got = parse_let(tokens, 0);
+    if (got.end_index + 1 != int(tokens.size()))
+      throw std::logic_error{format_line(def.line) + " The definition of '" +
+                             symbol_name(id) + "' doesn't end where 'load' "
+                             "expected it to, 'preload' the file instead!\n"};
+    got.result.is_global = true;
+    run_toplevel(got.result, {}, rt.constants);
+  } catch (std::logic_error& ex) {
+    throw std::logic_error{"(file " + def.file + ")\n" + ex.what()};
+  }
+  return rt.constants.find(id);
+}